@@ -16,7 +16,8 @@
 #' @param workers         Optional instance of QSys representing a worker pool
 #' @param log_worker      Write a log file for each worker
 #' @param chunk_size      Number of function calls to chunk together
-#'                        defaults to 100 chunks per worker or max. 10 kb per chunk
+#'                        defaults to 100 chunks per worker or max. 10 kb per chunk,
+#'                        or adapted to call times if `clustermq.chunk_time` is set
 #' @param timeout         Maximum time in seconds to wait for worker (default: Inf)
 #' @param max_calls_worker  Maxmimum number of chunks that will be sent to one worker
 #' @param verbose         Print status messages and progress bar (default: TRUE)
@@ -60,14 +60,18 @@ Q_rows = function(df, fun, const=list(), export=list(), pkgs=c(), seed=128965,
     if (!is.null(template$memory) && 2*sum(objs$size)/1024^2 > template$memory)
         stop("Not enough memory requested to unserialize data on workers")
 
-    # heuristic for chunk size
-    if (is.na(chunk_size))
+    # heuristic for chunk size if not given, adapted to call times if the
+    # clustermq.chunk_time option is set
+    chunk_time = 0
+    if (is.na(chunk_size)) {
+        chunk_time = getOption("clustermq.chunk_time", 0)
         chunk_size = round(Reduce(min, c(
             500,                    # never more than 500
             n_calls / n_jobs / 100, # each worker reports back 100 times
             n_calls / 2000,         # at most 2000 reports total
             1e4 * n_calls / utils::object.size(df)[[1]] # no more than 10 kb
         )))
+    }
     chunk_size = max(chunk_size, 1)
 
     # process calls
@@ -82,7 +86,7 @@ Q_rows = function(df, fun, const=list(), export=list(), pkgs=c(), seed=128965,
     } else {
         master(pool=workers, iter=df, rettype=rettype,
                fail_on_error=fail_on_error, chunk_size=chunk_size,
-               timeout=timeout, max_calls_worker=max_calls_worker,
+               chunk_time=chunk_time, timeout=timeout, max_calls_worker=max_calls_worker,
                verbose=verbose)
     }
 }
@@ -1,4 +1,5 @@
 loadModule("cmq_master", TRUE) # CMQMaster C++ class
+loadModule("cmq_loadgen", TRUE) # CMQLoadGen C++ class, for bench/loadgen.r
 
 #' Class for basic queuing system functions
 #'
@@ -9,8 +10,63 @@ loadModule("cmq_master", TRUE) # CMQMaster C++ class
 #' @keywords internal
 Pool = R6::R6Class("Pool",
     public = list(
-        initialize = function(addr=sample(host()), reuse=TRUE) {
+        initialize = function(addr=sample(host()), reuse=TRUE,
+                              compress=getOption("clustermq.compress", FALSE),
+                              delta=getOption("clustermq.delta", FALSE),
+                              lazy=getOption("clustermq.lazy", FALSE),
+                              fragment=getOption("clustermq.fragment", FALSE),
+                              prefetch=getOption("clustermq.prefetch", 1L),
+                              broadcast=getOption("clustermq.broadcast", FALSE),
+                              relay_timeout=getOption("clustermq.relay_timeout", 5),
+                              heartbeat=getOption("clustermq.heartbeat", FALSE),
+                              heartbeat_miss=getOption("clustermq.heartbeat_miss", 3L),
+                              proxy_cache=getOption("clustermq.proxy_cache", 1024^3),
+                              shm=getOption("clustermq.shm", FALSE),
+                              stats=getOption("clustermq.stats", FALSE),
+                              trace=getOption("clustermq.trace", NULL)) {
             private$master = methods::new(CMQMaster)
+            if (isTRUE(compress))
+                compress = 65536L
+            if (is.numeric(compress) && !is.na(compress))
+                private$master$set_compress(as.integer(compress))
+            if (isTRUE(delta))
+                delta = 65536L
+            if (is.numeric(delta) && !is.na(delta))
+                private$master$set_delta(as.integer(delta))
+            if (isTRUE(lazy))
+                lazy = 1048576L
+            if (is.numeric(lazy) && !is.na(lazy))
+                private$master$set_lazy(as.integer(lazy))
+            if (isTRUE(fragment))
+                fragment = 16777216L
+            if (is.numeric(fragment) && !is.na(fragment))
+                private$master$set_fragment(as.integer(fragment))
+            private$master$set_prefetch(as.integer(prefetch))
+            if (isTRUE(broadcast))
+                broadcast = 4L
+            if (is.numeric(broadcast) && !is.na(broadcast))
+                private$master$set_broadcast(as.integer(broadcast),
+                    as.integer(getOption("clustermq.ports", 6000:9999)),
+                    as.integer(relay_timeout * 1000))
+            if (isTRUE(heartbeat))
+                heartbeat = 5
+            if (is.numeric(heartbeat) && !is.na(heartbeat))
+                private$master$set_heartbeat(as.integer(heartbeat * 1000),
+                                             as.integer(heartbeat_miss))
+            if (is.numeric(proxy_cache) && !is.na(proxy_cache))
+                private$master$set_proxy_cache(as.numeric(proxy_cache))
+            if (isTRUE(shm))
+                shm = 1048576L
+            if (is.numeric(shm) && !is.na(shm))
+                private$master$set_shm(as.integer(shm))
+            if (isTRUE(stats) || is.character(stats))
+                private$master$set_stats(TRUE)
+            if (is.character(stats))
+                private$stats_file = stats
+            if (is.character(trace)) {
+                private$master$set_trace(TRUE)
+                private$trace_file = trace
+            }
             # ZeroMQ allows connecting by node name, but binding must be either
             # a numerical IP or an interface name. This is a bit of a hack to
             # seem to allow node-name bindings
@@ -31,7 +87,11 @@ Pool = R6::R6Class("Pool",
             times = do.call(rbind, info$time)[,1:3,drop=FALSE]
             mem = do.call(rbind, info$mem)
             do.call(data.frame, c(info[c("worker", "status")], current=list(info$worker==info$cur),
-                                  info["calls"], as.data.frame(times), mem=as.data.frame(mem)))
+                                  info[c("calls", "sent", "received")], as.data.frame(times),
+                                  mem=as.data.frame(mem)))
+        },
+        stats = function() {
+            private$master$stats()
         },
         current = function() {
             private$master$current()
@@ -76,12 +136,26 @@ Pool = R6::R6Class("Pool",
         },
 
         recv = function(timeout=-1L) {
+            self$workers$start()
             private$master$recv(timeout)
         },
 
+        map = function(iter, cmd, result, chunk_size, chunk_time=0,
+                       fail_on_error=TRUE, max_calls_worker=Inf, timeout=-1L,
+                       progress=NULL) {
+            self$workers$start()
+            private$master$map(iter, cmd, result, as.integer(chunk_size),
+                               as.numeric(chunk_time), fail_on_error, as.numeric(max_calls_worker),
+                               private$reuse, as.integer(timeout), progress)
+        },
+
         cleanup = function(timeout=5) {
             success = private$master$close(as.integer(timeout*1000))
             success = self$workers$cleanup(success, timeout) # timeout left?
+            if (!is.null(private$stats_file))
+                writeLines(prometheus_stats(self$stats()), private$stats_file)
+            if (!is.null(private$trace_file))
+                cat(private$master$trace(), file=private$trace_file)
 
             info = self$info()
             max_mem = max(c(0, info$mem.max), na.rm=TRUE)
@@ -120,6 +194,8 @@ Pool = R6::R6Class("Pool",
         addr = NULL,
         timer = NULL,
         reuse = NULL,
+        stats_file = NULL,
+        trace_file = NULL,
 
         finalize = function() {
             private$master$close(0L)
@@ -0,0 +1,48 @@
+loadModule("cmq_proxy", TRUE) # CMQProxy C++ class
+
+#' Proxy that starts workers and caches common data for them
+#'
+#' Do not call this manually, the SSH qsys or a scheduler with
+#' \code{clustermq.node_workers} set will do that
+#'
+#' @param master   The master (or parent proxy) address to connect to
+#' @param qsys_id  Character string of QSys class to use
+#' @param listen   Addresses to try binding to for workers to connect
+#' @param verbose  Whether to print debug messages
+#' @keywords internal
+proxy = function(master, qsys_id="multiprocess", listen=sample(host()), verbose=TRUE) {
+    message = msg_fmt(verbose)
+
+    p = methods::new(CMQProxy)
+    p$connect(master, 10000L)
+
+    tryCatch({
+        nodename = Sys.info()["nodename"]
+        addr = p$listen(sub(nodename, "*", listen, fixed=TRUE))
+        addr = sub("0.0.0.0", nodename, addr, fixed=TRUE)
+        message("listening for workers at ", addr)
+
+        p$proxy_request_cmd()
+        args = p$proxy_receive_cmd()
+        message("submit args: ", paste(mapply(paste, names(args), args, sep="="), collapse=", "))
+        stopifnot(inherits(args, "list"), "n_jobs" %in% names(args))
+
+        # set up qsys on cluster
+        message("setting up qsys: ", qsys_id)
+        if (toupper(qsys_id) %in% c("LOCAL", "SSH"))
+            stop("QSys ", sQuote(qsys_id), " is not allowed on a proxy")
+        qsys = get(toupper(qsys_id), envir=parent.env(environment()))
+        qsys = do.call(qsys$new, c(list(addr=addr, master=p), args))
+        on.exit(qsys$cleanup())
+
+        # messages are forwarded in a native thread until the master disconnects
+        p$start()
+        while(p$wait(1000L)) {}
+
+        message("shutting down")
+        p$close(1000L)
+
+    }, error = function(e) {
+        stop(e)
+    })
+}
@@ -33,6 +33,9 @@ QSys = R6::R6Class("QSys",
             private$defaults = getOption("clustermq.defaults", list())
         },
 
+        # Start workers that wait for the common data (no-op by default)
+        start = function() invisible(),
+
         cleanup = function(success, timeout) TRUE,
 
         n = function() private$workers_total
@@ -48,6 +51,14 @@ QSys = R6::R6Class("QSys",
         defaults = list(),
         is_cleaned_up = NULL,
 
+        # workers on this host connect via IPC if possible, where common data
+        # can be passed to them in shared memory
+        local_addr = function(addr) {
+            if (.Platform$OS.type == "windows")
+                return(addr)
+            tryCatch(private$master$listen_local(), error = function(e) addr)
+        },
+
         fill_options = function(...) {
             values = utils::modifyList(private$defaults, list(...))
             values$master = private$addr
@@ -55,6 +66,16 @@ QSys = R6::R6Class("QSys",
             if (!"job_name" %in% names(values))
                 values$job_name = paste0("cmq", private$port)
             private$workers_total = values$n_jobs
+
+            # start a proxy per job that runs node_workers workers and caches
+            # common data for them, so it is only sent once to each node
+            k = getOption("clustermq.node_workers", 1L)
+            if (!is.null(values$n_jobs) && k > 1) {
+                private$master$add_proxy_workers(as.integer(values$n_jobs), as.integer(k))
+                values$n_jobs = ceiling(values$n_jobs / k)
+                values$cores = k * as.integer(if (is.null(values$cores)) 1 else values$cores)
+                values$role = "proxy"
+            }
             values
         },
 
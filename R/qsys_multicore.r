@@ -7,17 +7,51 @@ MULTICORE = R6::R6Class("MULTICORE",
     inherit = QSys,
 
     public = list(
-        initialize = function(addr, n_jobs, master, ..., log_worker=FALSE, log_file=NULL, verbose=TRUE) {
+        initialize = function(addr, n_jobs, master, ..., log_worker=FALSE, log_file=NULL,
+                              fork_env=getOption("clustermq.fork_env", FALSE), verbose=TRUE) {
             addr = sub(Sys.info()["nodename"], "127.0.0.1", addr, fixed=TRUE)
             super$initialize(addr=addr, master=master)
+            private$addr = private$local_addr(addr)
             if (verbose)
                 message("Starting ", n_jobs, " cores ...")
             if (log_worker && is.null(log_file))
                 log_file = sprintf("cmq%i-%%i.log", private$port)
 
+            # with fork_env, children are forked once the common data is set
+            # and share it with the master instead of receiving a copy
+            private$log_file = log_file
+            if (isTRUE(fork_env))
+                private$fork_pending = n_jobs
+            else
+                private$fork_workers(n_jobs)
+            private$master$add_pending_workers(n_jobs)
+            private$workers_total = n_jobs
+            private$is_cleaned_up = FALSE
+        },
+
+        start = function() {
+            if (private$fork_pending > 0) {
+                n_jobs = private$fork_pending
+                private$fork_pending = 0
+                private$fork_workers(n_jobs, private$master$fork_env())
+            }
+        },
+
+        cleanup = function(success, timeout=5L) {
+            private$is_cleaned_up = success
+            private$collect_children(wait=FALSE, timeout=timeout)
+            private$finalize()
+        }
+    ),
+
+    private = list(
+        log_file = NULL,
+        fork_pending = 0,
+
+        fork_workers = function(n_jobs, preload=NULL) {
             for (i in seq_len(n_jobs)) {
-                if (is.character(log_file))
-                    log_i = suppressWarnings(sprintf(log_file, i))
+                if (is.character(private$log_file))
+                    log_i = suppressWarnings(sprintf(private$log_file, i))
                 else
                     log_i = nullfile()
                 wrapper = function(m, logfile) {
@@ -25,24 +59,13 @@ MULTICORE = R6::R6Class("MULTICORE",
                     sink(file=fout, type="output")
                     sink(file=fout, type="message")
                     on.exit({ sink(type="message"); sink(type="output"); close(fout) })
-                    clustermq:::worker(m)
+                    clustermq:::worker(m, preload=preload)
                 }
                 p = parallel::mcparallel(quote(wrapper(private$addr, log_i)))
                 private$children[[as.character(p$pid)]] = p
             }
-            private$master$add_pending_workers(n_jobs)
-            private$workers_total = n_jobs
-            private$is_cleaned_up = FALSE
         },
 
-        cleanup = function(success, timeout=5L) {
-            private$is_cleaned_up = success
-            private$collect_children(wait=FALSE, timeout=timeout)
-            private$finalize()
-        }
-    ),
-
-    private = list(
         collect_children = function(...) {
             pids = as.integer(names(private$children))
             res = suppressWarnings(parallel::mccollect(pids, ...))
@@ -12,6 +12,7 @@ MULTIPROCESS = R6::R6Class("MULTIPROCESS",
                 stop("The ", sQuote(callr), " package is required for ", sQuote("multiprocess"))
             addr = sub(Sys.info()["nodename"], "127.0.0.1", addr, fixed=TRUE)
             super$initialize(addr=addr, master=master)
+            private$addr = private$local_addr(addr)
 
             if (verbose)
                 message("Starting ", n_jobs, " processes ...")
@@ -30,6 +30,9 @@ fill_template = function(template, values, required=c()) {
     if (! all(required %in% keys))
         stop("Template keys required but not provided: ",
              paste(setdiff(required, keys), collapse=", "))
+    if ("role" %in% names(values) && ! "role" %in% keys)
+        stop("Template needs to start clustermq:::{{ role | worker }}() ",
+             "instead of a fixed worker() for clustermq.node_workers > 1")
 
     upd = keys %in% names(values)
     is_num = sapply(values, is.numeric)
@@ -77,3 +80,32 @@ msg_fmt = function(verbose=TRUE) {
     else
         function(...) invisible(NULL)
 }
+
+#' Prometheus text format of master and worker stats
+#'
+#' @param stats  List as returned by \code{CMQMaster$stats()}
+#' @return  Character vector of exposition lines
+#' @keywords internal
+prometheus_stats = function(stats) {
+    hist = function(side, s) {
+        metric = sprintf("clustermq_%s_stage_seconds", side)
+        le = colnames(s$buckets)
+        lines = lapply(seq_len(nrow(s$stages)), function(i) {
+            stage = s$stages$stage[i]
+            c(sprintf('%s_bucket{stage="%s",le="%s"} %.0f', metric, stage, le,
+                      cumsum(s$buckets[i,])),
+              sprintf('%s_sum{stage="%s"} %.9g', metric, stage, s$stages$total[i]),
+              sprintf('%s_count{stage="%s"} %.0f', metric, stage, s$stages$count[i]))
+        })
+        c(sprintf("# TYPE %s histogram", metric), unlist(lines))
+    }
+    bytes = function(metric, label, keys, values)
+        c(sprintf("# TYPE %s counter", metric),
+          sprintf('%s{%s="%s"} %.0f', metric, label, gsub('(["\\])', "\\\\\\1", keys), values))
+
+    c(hist("master", stats$master),
+      hist("worker", stats$workers),
+      bytes("clustermq_worker_sent_bytes_total", "worker", stats$peers$worker, stats$peers$sent),
+      bytes("clustermq_worker_received_bytes_total", "worker", stats$peers$worker, stats$peers$received),
+      bytes("clustermq_env_sent_bytes_total", "object", stats$env$object, stats$env$sent))
+}
@@ -9,8 +9,9 @@ utils::globalVariables(c("common_seed", "const", "fun")) # worker .GlobalEnv
 #' @param ...      Catch-all to not break older template values (ignored)
 #' @param verbose  Whether to print debug messages
 #' @param context  ZeroMQ context (for internal testing)
+#' @param preload  Common data the worker was forked with (from \code{CMQMaster$fork_env()})
 #' @keywords internal
-worker = function(master, ..., verbose=TRUE, context=NULL) {
+worker = function(master, ..., verbose=TRUE, context=NULL, preload=NULL) {
     message = msg_fmt(verbose)
 
     #TODO: replace this by proper authentication
@@ -25,6 +26,8 @@ worker = function(master, ..., verbose=TRUE, context=NULL) {
         w = methods::new(CMQWorker)
     else
         w = methods::new(CMQWorker, context)
+    if (!is.null(preload))
+        w$preload(preload)
     message("connecting to: ", master)
     w$connect(master, 10000L)
 
@@ -0,0 +1,40 @@
+# End-to-end task throughput of Q() on local workers, without a scheduler
+#
+# Calls of a trivial function are processed in the main process (LOCAL) and
+# by forked (multicore) or new (multiprocess) worker processes. These connect
+# via IPC by default, or via TCP on the loopback interface.
+#
+# Usage: Rscript bench/Q.r [calls] [workers]
+source("bench/common.r")
+
+# workers that connect via TCP even if they could use IPC
+TCP_MULTICORE = R6::R6Class("TCP_MULTICORE", inherit = clustermq:::MULTICORE,
+    private = list(local_addr = function(addr) addr))
+TCP_MULTIPROCESS = R6::R6Class("TCP_MULTIPROCESS", inherit = clustermq:::MULTIPROCESS,
+    private = list(local_addr = function(addr) addr))
+
+bench_Q = function(calls=1e5, n_jobs=2) {
+    qsys = list(LOCAL = NULL,
+                "multicore/ipc" = clustermq:::MULTICORE,
+                "multicore/tcp" = TCP_MULTICORE)
+    if (requireNamespace("callr", quietly=TRUE))
+        qsys = c(qsys, list("multiprocess/ipc" = clustermq:::MULTIPROCESS,
+                            "multiprocess/tcp" = TCP_MULTIPROCESS))
+
+    res = lapply(names(qsys), function(name) {
+        w = clustermq:::Pool$new(addr="tcp://127.0.0.1:*", reuse=FALSE)
+        if (is.null(qsys[[name]]))
+            w$add(clustermq:::LOCAL, 0L, verbose=FALSE)
+        else
+            w$add(qsys[[name]], as.integer(n_jobs), verbose=FALSE)
+        secs = system.time(Q(function(x) x, x=seq_len(calls), workers=w,
+                             rettype="integer", timeout=60L))[["elapsed"]]
+        bench_result("Q", name, calls / secs, "calls/s")
+    })
+    do.call(rbind, res)
+}
+
+if (sys.nframe() == 0L) {
+    args = bench_args(calls=1e5, n_jobs=2)
+    bench_print(bench_Q(args$calls, args$n_jobs))
+}
@@ -0,0 +1,24 @@
+# Helpers shared by the benchmark scripts
+#
+# Each benchmark returns a data.frame with one row per measurement, which the
+# scripts print when run on their own and bench/run.r collects into a CSV file
+library(clustermq)
+
+bench_result = function(benchmark, case, value, unit) {
+    data.frame(benchmark=benchmark, case=case, value=value, unit=unit,
+               stringsAsFactors=FALSE)
+}
+
+bench_print = function(res) {
+    cat(sprintf("%-10s %-32s %12.4g %s\n", res$benchmark, res$case, res$value, res$unit),
+        sep="")
+    invisible(res)
+}
+
+# numeric command line arguments, or their defaults
+bench_args = function(...) {
+    defaults = c(...)
+    args = as.numeric(commandArgs(TRUE))
+    defaults[seq_along(args)] = args
+    as.list(defaults)
+}
@@ -0,0 +1,48 @@
+# Cost of common data on calls to a worker, by number of exported objects
+#
+# After exporting a number of small objects, the first call sends them all to
+# the worker, and the following ones only check that it holds them already.
+# Both are timed for a local worker connected via TCP.
+#
+# Usage: Rscript bench/env.r [max objects] [calls]
+source("bench/common.r")
+
+bench_env = function(max_objs=1000, calls=1000) {
+    m = methods::new(clustermq:::CMQMaster)
+    addr = m$listen("tcp://127.0.0.1:*")
+    m$add_pending_workers(1L)
+    w = parallel::mcparallel(clustermq:::worker(addr, verbose=FALSE))
+    stopifnot(is.null(m$recv(10000L)))
+
+    res = list()
+    n_objs = 0
+    for (n in 10^seq(0, log10(max_objs))) {
+        while (n_objs < n) {
+            n_objs = n_objs + 1
+            m$add_env(paste0("obj", n_objs), n_objs)
+        }
+        first = system.time({
+            m$send_eval(expression(NULL))
+            m$recv(10000L)
+        })[["elapsed"]]
+        secs = system.time({
+            for (i in seq_len(calls)) {
+                m$send_eval(expression(NULL))
+                m$recv(10000L)
+            }
+        })[["elapsed"]]
+        case = sprintf("%i objects", n_objs)
+        res = c(res, list(bench_result("env_first", case, 1000 * first, "ms"),
+                          bench_result("env_calls", case, calls / secs, "calls/s")))
+    }
+
+    m$send_shutdown()
+    parallel::mccollect(w, wait=TRUE, timeout=5)
+    m$close(0L)
+    do.call(rbind, res)
+}
+
+if (sys.nframe() == 0L) {
+    args = bench_args(max_objs=1000, calls=1000)
+    bench_print(bench_env(args$max_objs, args$calls))
+}
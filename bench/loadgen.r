@@ -0,0 +1,73 @@
+# Calls per second, latency and memory of the master with many workers
+#
+# The workers are simulated by CMQLoadGen in a forked process: sockets spread
+# over a few threads that answer each call after 'delay' ms with a raw vector
+# of 'size' bytes, without evaluating anything, so thousands of them fit on
+# one machine. As in bench/scaling.r, the master sends an empty call for each
+# result. Many workers need a higher limit of open files (ulimit -n).
+#
+# Usage: Rscript bench/loadgen.r [calls per worker] [delay ms] [result bytes] [workers]
+source("bench/common.r")
+
+# resident memory of this process in bytes, NA if not on Linux
+mem_rss = function() {
+    status = tryCatch(readLines("/proc/self/status"), error=function(e) character())
+    rss = grep("^VmRSS:", status, value=TRUE)
+    if (length(rss) == 0) NA_real_ else as.numeric(gsub("[^0-9]", "", rss)) * 1024
+}
+
+bench_loadgen = function(calls=20L, delay=0L, size=0L, n_workers=c(1000L, 5000L, 20000L),
+                         threads=4L) {
+    res = lapply(n_workers, function(n) {
+        m = methods::new(clustermq:::CMQMaster)
+        addr = m$listen("tcp://127.0.0.1:*")
+        m$add_pending_workers(n)
+        gen = parallel::mcparallel({
+            lg = methods::new(clustermq:::CMQLoadGen)
+            lg$start(addr, n, threads, delay, size, 0L)
+            lg$stop(600000L)
+        })
+
+        for (i in seq_len(n)) { # workers connecting
+            m$recv(60000L)
+            m$send_eval(expression(NULL))
+        }
+        secs = system.time({
+            for (i in seq_len(n * calls)) {
+                m$recv(60000L)
+                m$send_eval(expression(NULL))
+            }
+        })[["elapsed"]]
+        rss = mem_rss()
+        for (i in seq_len(n)) {
+            m$recv(60000L)
+            m$send_shutdown()
+        }
+
+        lg = parallel::mccollect(gen, wait=TRUE)[[1]]
+        if (inherits(lg, "try-error"))
+            stop(lg)
+        master = m$stats()$master$stages
+        m$close(0L)
+
+        rt = master[master$stage == "roundtrip",]
+        ta = lg$stages[lg$stages$stage == "turnaround",]
+        case = function(x) sprintf("%i workers, %s", n, x)
+        rbind(bench_result("loadgen", case("master"), n * calls / secs, "calls/s"),
+              bench_result("loadgen", case("roundtrip p50"), rt$p50 * 1e3, "ms"),
+              bench_result("loadgen", case("roundtrip p99"), rt$p99 * 1e3, "ms"),
+              bench_result("loadgen", case("turnaround p50"), ta$p50 * 1e3, "ms"),
+              bench_result("loadgen", case("turnaround p99"), ta$p99 * 1e3, "ms"),
+              bench_result("loadgen", case("master RSS"), rss / 1e6, "MB"))
+    })
+    do.call(rbind, res)
+}
+
+if (sys.nframe() == 0L) {
+    args = as.integer(commandArgs(TRUE))
+    calls = if (length(args) > 0) args[1] else 20L
+    delay = if (length(args) > 1) args[2] else 0L
+    size = if (length(args) > 2) args[3] else 0L
+    n_workers = if (length(args) > 3) args[-(1:3)] else c(1000L, 5000L, 20000L)
+    bench_print(bench_loadgen(calls, delay, size, n_workers))
+}
@@ -0,0 +1,41 @@
+# Throughput of serializing R objects to ZeroMQ frames and back
+#
+# Objects of different types and sizes are serialized natively to a frame and
+# unserialized again, without sending them, uncompressed and with the default
+# compression threshold.
+#
+# Usage: Rscript bench/messages.r [max size in MB] [repetitions]
+source("bench/common.r")
+
+bench_messages = function(max_mb=64, reps=5) {
+    objs = list(
+        numeric = function(n) runif(n / 8),
+        integer = function(n) sample.int(100L, n / 4, replace=TRUE),
+        character = function(n) as.character(sample.int(1e4L, n / 8, replace=TRUE)),
+        list = function(n) as.list(runif(n / 64)),
+        data.frame = function(n) data.frame(x=runif(n / 16), y=sample.int(10L, n / 16, replace=TRUE))
+    )
+    sizes = 2^seq(10, log2(max_mb * 1024^2), by=4)
+    res = list()
+    for (type in names(objs)) {
+        for (size in sizes) {
+            obj = objs[[type]](size)
+            for (compress in c(-1L, 65536L)) {
+                t = clustermq:::time_msg_roundtrip(obj, as.integer(reps), compress)
+                case = sprintf("%s/%.0fkB/%s", type, size / 1024,
+                               if (compress < 0) "raw" else "lz")
+                mb = as.numeric(object.size(obj)) * reps / 1024^2
+                res = c(res, list(
+                    bench_result("r2msg", case, mb / t[["serialize"]], "MB/s"),
+                    bench_result("msg2r", case, mb / t[["unserialize"]], "MB/s"),
+                    bench_result("frame", case, t[["bytes"]] / as.numeric(object.size(obj)), "ratio")))
+            }
+        }
+    }
+    do.call(rbind, res)
+}
+
+if (sys.nframe() == 0L) {
+    args = bench_args(max_mb=64, reps=5)
+    bench_print(bench_messages(args$max_mb, args$reps))
+}
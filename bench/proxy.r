@@ -0,0 +1,44 @@
+# Throughput of a proxy forwarding common data from the master to a worker
+#
+# Each repetition exports a new object, so it is sent to the proxy in full,
+# cached there and forwarded. The proxy event that receives and forwards the
+# object is timed, but not the evaluation on the worker.
+#
+# Usage: Rscript bench/proxy.r [object size in MB] [repetitions]
+source("bench/common.r")
+
+bench_proxy = function(size_mb=100, reps=10) {
+    m = methods::new(clustermq:::CMQMaster)
+    p = methods::new(clustermq:::CMQProxy)
+    addr1 = m$listen("tcp://127.0.0.1:*")
+    addr2 = p$listen("tcp://127.0.0.1:*")
+    m$add_pending_workers(1L)
+    m$set_proxy_cache(2 * size_mb * 1024^2) # two objects
+    p$connect(addr1, 1000L)
+    w = parallel::mcparallel(clustermq:::worker(addr2, verbose=FALSE))
+    stopifnot(p$process_one(), is.null(m$recv(10000L)))
+
+    bytes = secs = numeric(reps)
+    for (i in seq_len(reps)) {
+        m$add_env("x", runif(size_mb * 1024^2 / 8))
+        bytes[i] = m$list_env()$size
+        m$send_eval(expression(length(x)))
+        secs[i] = system.time(p$process_one())[["elapsed"]]
+        stopifnot(p$process_one(), m$recv(10000L) == size_mb * 1024^2 / 8)
+    }
+
+    m$send_shutdown()
+    p$process_one()
+    parallel::mccollect(w, wait=TRUE, timeout=5)
+    p$close(0L)
+    m$close(0L)
+
+    case = sprintf("%.0f MB", mean(bytes) / 1024^2)
+    rbind(bench_result("proxy", case, sum(bytes) / sum(secs) / 1e9, "GB/s"),
+          bench_result("proxy", paste(case, "median"), 1000 * stats::median(secs), "ms"))
+}
+
+if (sys.nframe() == 0L) {
+    args = bench_args(size_mb=100, reps=10)
+    bench_print(bench_proxy(args$size_mb, args$reps))
+}
@@ -0,0 +1,22 @@
+# Runs all benchmarks with short settings and writes their results as CSV
+#
+# Each row has the package version and date, so files of different releases
+# can be combined to track throughput and per-message overhead.
+#
+# Usage: Rscript bench/run.r [output file, default stdout]
+for (f in c("messages", "env", "proxy", "scaling", "loadgen", "Q"))
+    source(file.path("bench", paste0(f, ".r")))
+
+res = rbind(bench_messages(max_mb=16, reps=3),
+            bench_env(max_objs=1000, calls=500),
+            bench_proxy(size_mb=50, reps=5),
+            bench_scaling(calls=20L, n_workers=c(1L, 10L, 50L)),
+            bench_loadgen(calls=20L, n_workers=200L),
+            bench_Q(calls=1e4, n_jobs=2))
+res = cbind(version=as.character(utils::packageVersion("clustermq")),
+            date=format(Sys.Date()), res)
+
+out = commandArgs(TRUE)
+if (length(out) == 0)
+    out = stdout()
+utils::write.csv(res, out, row.names=FALSE)
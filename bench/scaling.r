@@ -0,0 +1,48 @@
+# Calls per second the master handles depending on the number of workers
+#
+# Each worker gets empty calls as soon as it returns the previous one, so the
+# time is spent in the master's bookkeeping and messaging rather than on the
+# workers. A few common data objects are exported, which are sent only once
+# but checked on every call.
+#
+# Usage: Rscript bench/scaling.r [calls per worker] [worker counts...]
+source("bench/common.r")
+
+bench_scaling = function(calls=20L, n_workers=c(1L, 10L, 100L, 500L)) {
+    res = lapply(n_workers, function(n) {
+        m = methods::new(clustermq:::CMQMaster)
+        addr = m$listen("tcp://127.0.0.1:*")
+        m$add_pending_workers(n)
+        for (i in 1:10)
+            m$add_env(paste0("obj", i), i)
+        ws = lapply(seq_len(n), function(i)
+            parallel::mcparallel(clustermq:::worker(addr, verbose=FALSE)))
+
+        for (i in seq_len(n)) { # workers connecting
+            m$recv(30000L)
+            m$send_eval(expression(NULL))
+        }
+        secs = system.time({
+            for (i in seq_len(n * calls)) {
+                m$recv(30000L)
+                m$send_eval(expression(NULL))
+            }
+        })[["elapsed"]]
+        for (i in seq_len(n)) {
+            m$recv(30000L)
+            m$send_shutdown()
+        }
+
+        parallel::mccollect(ws, wait=TRUE, timeout=5)
+        m$close(0L)
+        bench_result("scaling", sprintf("%i workers", n), n * calls / secs, "calls/s")
+    })
+    do.call(rbind, res)
+}
+
+if (sys.nframe() == 0L) {
+    args = as.integer(commandArgs(TRUE))
+    calls = if (length(args) > 0) args[1] else 20L
+    n_workers = if (length(args) > 1) args[-1] else c(1L, 10L, 100L, 500L)
+    bench_print(bench_scaling(calls, n_workers))
+}
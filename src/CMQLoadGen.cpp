@@ -0,0 +1,10 @@
+#include "CMQLoadGen.h"
+
+RCPP_MODULE(cmq_loadgen) {
+    using namespace Rcpp;
+    class_<CMQLoadGen>("CMQLoadGen")
+        .constructor()
+        .method("start", &CMQLoadGen::start)
+        .method("stop", &CMQLoadGen::stop)
+    ;
+}
@@ -0,0 +1,276 @@
+#include <Rcpp.h>
+#include <atomic>
+#include <functional>
+#include <queue>
+#include "common.h"
+#include "memory.h"
+#include "stats.h"
+
+// Synthetic workers to stress-test the master: DEALER sockets that connect
+// like CMQWorker and answer each call after a fixed delay with a result of a
+// given size, without unserializing or evaluating anything. The sockets are
+// spread over a few threads that only use zmq, so that one process can
+// simulate thousands of workers
+class CMQLoadGen {
+public:
+    CMQLoadGen() = default;
+    ~CMQLoadGen() { close(); }
+
+    // 'delay' in ms per call, 'heartbeat' in ms or 0 to not send any
+    void start(std::string addr, int n_workers, int n_threads=4, int delay=0,
+            int result_size=0, int heartbeat=0) {
+        if (!threads.empty())
+            Rcpp::stop("Load generator is already running");
+        if (n_workers < 1 || n_threads < 1)
+            Rcpp::stop("Need at least one worker and thread");
+        n_threads = std::min(n_threads, n_workers);
+
+        // serialized once here, the threads send copies
+        std::vector<zmq::message_t> reply;
+        reply.push_back(r2msg(proc_time()));
+        reply.push_back(r2msg(mem_stats()));
+        reply.push_back(r2msg(Rcpp::RawVector(result_size)));
+        zmq::message_t null_msg = r2msg(R_NilValue);
+
+        ctx = new zmq::context_t(n_threads);
+        ctx->set(zmq::ctxopt::max_sockets, n_workers + 16);
+        stopping = false;
+        n_open = n_workers;
+        started = Time::now();
+        threads = std::vector<thread_t>(n_threads);
+        for (int t=0; t<n_threads; t++) {
+            auto &th = threads[t];
+            th.addr = addr;
+            th.n = n_workers / n_threads + (t < n_workers % n_threads);
+            th.delay = delay;
+            th.heartbeat = heartbeat;
+            for (auto &msg : reply) {
+                th.reply.emplace_back();
+                th.reply.back().copy(msg);
+            }
+            th.hello.copy(null_msg);
+        }
+        for (auto &th : threads)
+            th.thread = std::thread(&CMQLoadGen::run, this, std::ref(th));
+    }
+
+    // waits up to 'timeout' ms for the master to shut down all workers, and
+    // returns what they counted
+    Rcpp::List stop(int timeout=5000) {
+        if (threads.empty())
+            Rcpp::stop("Load generator is not running");
+        auto until = Time::now() + ms(timeout);
+        while (n_open > 0 && Time::now() < until) {
+            if (pending_interrupt())
+                break;
+            std::this_thread::sleep_for(ms(10));
+        }
+        double elapsed = std::chrono::duration<double>(Time::now() - started).count();
+        int open = n_open;
+        close();
+
+        stats_t timings(loadgen_stages);
+        uint64_t calls = 0, sent = 0, received = 0;
+        std::string error;
+        for (const auto &th : threads) {
+            timings.merge(th.timings);
+            calls += th.calls;
+            sent += th.sent;
+            received += th.received;
+            if (error.empty())
+                error = th.error;
+        }
+        threads.clear();
+        if (!error.empty())
+            Rcpp::stop(error);
+
+        auto res = timings.to_r();
+        res.push_back(static_cast<double>(calls), "calls");
+        res.push_back(static_cast<double>(sent), "sent");
+        res.push_back(static_cast<double>(received), "received");
+        res.push_back(elapsed, "elapsed");
+        res.push_back(open, "open");
+        return res;
+    }
+
+private:
+    struct thread_t {
+        std::thread thread;
+        std::string addr;
+        int n {0};
+        int delay {0};
+        int heartbeat {0};
+        std::vector<zmq::message_t> reply; // time, mem, and result
+        zmq::message_t hello; // NULL for the first message
+        stats_t timings {loadgen_stages};
+        uint64_t calls {0};
+        uint64_t sent {0}; // bytes
+        uint64_t received {0};
+        std::string error;
+    };
+    struct fake_t {
+        zmq::socket_t sock;
+        bool first {true}; // no call received yet
+        int queued {0}; // calls not yet answered
+        Time::time_point busy_until; // reply to the last queued call
+        Time::time_point idle_since; // last reply, or connect
+        Time::time_point last_sent;
+    };
+    typedef std::pair<Time::time_point, size_t> due_t;
+
+    zmq::context_t *ctx {nullptr};
+    std::vector<thread_t> threads;
+    std::atomic<bool> stopping {false};
+    std::atomic<int> n_open {0};
+    Time::time_point started;
+    Rcpp::Function proc_time {"proc.time"};
+
+    void close() {
+        stopping = true;
+        for (auto &th : threads) {
+            if (th.thread.joinable())
+                th.thread.join();
+        }
+        if (ctx != nullptr) {
+            ctx->close();
+            delete ctx;
+            ctx = nullptr;
+        }
+    }
+
+    void send(thread_t &th, fake_t &f, std::vector<zmq::message_t> &msgs) {
+        for (const auto &msg : msgs)
+            th.sent += msg.size();
+        send_multipart(f.sock, msgs);
+        f.last_sent = Time::now();
+    }
+
+    // only zmq calls here, no R API
+    void run(thread_t &th) {
+        std::vector<fake_t> fakes(th.n);
+        std::priority_queue<due_t, std::vector<due_t>, std::greater<due_t>> due;
+        std::vector<zmq::pollitem_t> pitems;
+        std::vector<size_t> pitem2fake;
+        auto last_hb = Time::now();
+        int open = 0, closed = 0;
+
+        try {
+            for (auto &f : fakes) {
+                f.sock = zmq::socket_t(*ctx, ZMQ_DEALER);
+                f.sock.connect(th.addr);
+                std::vector<zmq::message_t> msgs;
+                msgs.emplace_back(0);
+                msgs.push_back(int2msg(wlife_t::active));
+                for (size_t i=0; i<2; i++) {
+                    msgs.emplace_back();
+                    msgs.back().copy(th.reply[i]);
+                }
+                msgs.emplace_back();
+                msgs.back().copy(th.hello);
+                msgs.push_back(int2msg(0)); // flags: tcp, nothing preloaded
+                send(th, f, msgs);
+                f.idle_since = f.last_sent;
+                open++;
+            }
+
+            while (!stopping && open > 0) {
+                if (pitems.size() != static_cast<size_t>(open)) { // sockets closed
+                    pitems.clear();
+                    pitem2fake.clear();
+                    for (size_t i=0; i<fakes.size(); i++) {
+                        if (fakes[i].sock.handle() == nullptr)
+                            continue;
+                        pitems.push_back(zmq::pollitem_t{fakes[i].sock.handle(), 0, ZMQ_POLLIN, 0});
+                        pitem2fake.push_back(i);
+                    }
+                }
+
+                auto wait = ms(100); // check for stop() regularly
+                if (!due.empty())
+                    wait = std::min(wait, std::chrono::duration_cast<ms>(due.top().first - Time::now()));
+                if (th.heartbeat > 0)
+                    wait = std::min(wait, ms(th.heartbeat / 2));
+                try {
+                    zmq::poll(pitems, std::max(wait, ms(0)));
+                } catch (zmq::error_t const &e) {
+                    if (errno == EINTR)
+                        continue;
+                    throw;
+                }
+
+                for (size_t i=0; i<pitems.size(); i++) {
+                    if (pitems[i].revents == 0)
+                        continue;
+                    auto &f = fakes[pitem2fake[i]];
+                    while (f.sock.handle() != nullptr) {
+                        std::vector<zmq::message_t> msgs;
+                        if (!recv_multipart(f.sock, std::back_inserter(msgs), zmq::recv_flags::dontwait))
+                            break;
+                        for (const auto &msg : msgs)
+                            th.received += msg.size();
+                        if (msgs.size() < 2 || msgs[0].size() != 0)
+                            throw std::runtime_error("No frame delimiter found at expected position");
+                        auto status = msg2wlife_t(msgs[1]);
+                        if (status == wlife_t::shutdown) {
+                            f.sock.set(zmq::sockopt::linger, 0);
+                            f.sock.close();
+                            open--;
+                            closed++;
+                            n_open--;
+                        } else if (status == wlife_t::active) {
+                            auto now = Time::now();
+                            if (f.queued == 0) {
+                                th.timings.add(f.first ? ls_connect : ls_turnaround, f.idle_since);
+                                f.busy_until = now;
+                            }
+                            f.first = false;
+                            f.busy_until = std::max(f.busy_until, now) + ms(th.delay);
+                            f.queued++;
+                            due.push(due_t(f.busy_until, pitem2fake[i]));
+                        } // others, like fragment replies, need no answer here
+                    }
+                }
+
+                while (!due.empty() && due.top().first <= Time::now()) {
+                    auto &f = fakes[due.top().second];
+                    due.pop();
+                    if (f.sock.handle() == nullptr)
+                        continue;
+                    std::vector<zmq::message_t> msgs;
+                    msgs.emplace_back(0);
+                    msgs.push_back(int2msg(wlife_t::active));
+                    for (auto &msg : th.reply) {
+                        msgs.emplace_back();
+                        msgs.back().copy(msg);
+                    }
+                    send(th, f, msgs);
+                    th.calls++;
+                    if (--f.queued == 0)
+                        f.idle_since = f.last_sent;
+                }
+
+                if (th.heartbeat > 0 && Time::now() - last_hb >= ms(th.heartbeat / 2)) {
+                    auto now = Time::now();
+                    for (auto &f : fakes) {
+                        if (f.sock.handle() == nullptr || now - f.last_sent < ms(th.heartbeat))
+                            continue;
+                        if (f.sock.send(zmq::message_t(0), zmq::send_flags::sndmore | zmq::send_flags::dontwait))
+                            f.sock.send(int2msg(wlife_t::heartbeat), zmq::send_flags::none);
+                        f.last_sent = now;
+                    }
+                    last_hb = now;
+                }
+            }
+        } catch (std::exception const &e) {
+            th.error = e.what();
+        }
+
+        for (auto &f : fakes) {
+            if (f.sock.handle() != nullptr) {
+                f.sock.set(zmq::sockopt::linger, 0);
+                f.sock.close();
+            }
+        }
+        n_open -= th.n - closed;
+    }
+};
@@ -7,18 +7,35 @@ RCPP_MODULE(cmq_master) {
         .constructor()
         .method("context", &CMQMaster::context)
         .method("listen", &CMQMaster::listen)
+        .method("listen_local", &CMQMaster::listen_local)
         .method("close", &CMQMaster::close)
         .method("recv", &CMQMaster::recv)
         .method("send_eval", &CMQMaster::send_eval)
         .method("send_shutdown", &CMQMaster::send_shutdown)
+        .method("map", &CMQMaster::map)
         .method("proxy_submit_cmd", &CMQMaster::proxy_submit_cmd)
         .method("add_env", &CMQMaster::add_env)
         .method("add_pkg", &CMQMaster::add_pkg)
+        .method("fork_env", &CMQMaster::fork_env)
         .method("list_env", &CMQMaster::list_env)
+        .method("set_compress", &CMQMaster::set_compress)
+        .method("set_delta", &CMQMaster::set_delta)
+        .method("set_fragment", &CMQMaster::set_fragment)
+        .method("set_heartbeat", &CMQMaster::set_heartbeat)
+        .method("set_broadcast", &CMQMaster::set_broadcast)
+        .method("set_lazy", &CMQMaster::set_lazy)
+        .method("set_stats", &CMQMaster::set_stats)
+        .method("set_trace", &CMQMaster::set_trace)
+        .method("set_shm", &CMQMaster::set_shm)
+        .method("set_prefetch", &CMQMaster::set_prefetch)
+        .method("set_proxy_cache", &CMQMaster::set_proxy_cache)
         .method("add_pending_workers", &CMQMaster::add_pending_workers)
+        .method("add_proxy_workers", &CMQMaster::add_proxy_workers)
         .method("list_workers", &CMQMaster::list_workers)
         .method("current", &CMQMaster::current)
         .method("workers_running", &CMQMaster::workers_running)
         .method("workers_total", &CMQMaster::workers_total)
+        .method("stats", &CMQMaster::stats)
+        .method("trace", &CMQMaster::trace)
     ;
 }
@@ -1,5 +1,11 @@
 #include <Rcpp.h>
+#include <cmath>
+#include <list>
+#include <random>
 #include "common.h"
+#include "shm.h"
+#include "stats.h"
+#include "trace.h"
 
 class CMQMaster {
 public:
@@ -31,6 +37,16 @@ public:
         }
         Rcpp::stop("Could not bind port to any address in provided pool");
     }
+    // workers on the same host can connect via IPC in addition
+    std::string listen_local() {
+        try {
+            sock.bind("ipc://*");
+        } catch(zmq::error_t const &e) {
+            Rcpp::stop(std::string("Binding IPC endpoint failed (") + e.what() + ")");
+        }
+        has_local = true;
+        return sock.get(zmq::sockopt::last_endpoint);
+    }
 
     bool close(int timeout=1000) {
         if (ctx == nullptr)
@@ -44,15 +60,14 @@ public:
         auto time_left = time_ms;
         auto start = Time::now();
         while (time_left.count() > 0) {
-            if (std::find_if(peers.begin(), peers.end(), [](const std::pair<const std::string, worker_t> &w) { // 'const auto &w' is C++14
-                        return w.second.status == wlife_t::active; }) == peers.end()) {
+            if (n_active == 0) {
                 is_cleaned_up = true;
                 break;
             }
 
             if (peers.find(cur) != peers.end()) {
                 auto &w = peers[cur];
-                if (w.status == wlife_t::active && w.call == R_NilValue)
+                if (w.status == wlife_t::active && w.calls.empty())
                     try {
                         send_shutdown();
                     } catch (...) {}
@@ -76,6 +91,16 @@ public:
         };
 
         env.clear();
+        env_ids.clear();
+        env_slots.clear();
+        env_set.clear();
+        env_refs.clear();
+        ++env_version;
+        deltas.clear();
+        trees.clear();
+        shm_names.clear();
+        shm_retired.clear();
+        forked_env.clear();
         pending_workers = 0;
 
         if (sock.handle() != nullptr) {
@@ -94,12 +119,7 @@ public:
         std::vector<zmq::message_t> msgs;
 
         do {
-            int w_active = pending_workers;
-            for (const auto &kv: peers) {
-                if (kv.second.status == wlife_t::active || kv.second.status == wlife_t::proxy_cmd)
-                    w_active++;
-            }
-            if (w_active <= 0)
+            if (pending_workers + n_active + n_proxies <= 0)
                 Rcpp::stop("Trying to receive data without workers");
 
             msgs.clear();
@@ -108,41 +128,134 @@ public:
             data_offset = register_peer(msgs);
         } while(data_offset >= msgs.size());
 
-        return msg2r(std::move(msgs[data_offset]), true);
+        // atomic results of a columnar chunk may follow in a typed frame,
+        // and workers asked for their stats and call times send them last
+        auto start = Time::now();
+        typed = zmq::message_t();
+        for (size_t i=data_offset+1; i<msgs.size(); i++) {
+            auto msg = decompress_msg(std::move(msgs[i]));
+            if (is_typed_result(msg)) {
+                typed = std::move(msg);
+            } else if (is_stats(msg)) {
+                auto &w = peers[cur];
+                uint64_t sent, received;
+                w.stats.decode(msg, sent, received);
+            } else if (tracing && is_trace(msg)) {
+                trace_result(peers[cur], trace_decode(msg));
+            }
+        }
+
+        SEXP res = msg2r(std::move(msgs[data_offset]), true);
+        timings.add(ms_unserialize, start);
+        return res;
     }
 
     int send_eval(SEXP cmd) {
+        return send_call(cmd, zmq::message_t());
+    }
+    // 'chunk' is a columnar frame that the worker decodes as the first
+    // argument of 'cmd', if not empty
+    int send_call(SEXP cmd, zmq::message_t &&chunk) {
         auto &w = check_current_worker(wlife_t::active);
-        auto add_to_worker = set_difference(env_names, w.env);
         auto mp = init_multipart(w, wlife_t::active);
-        mp.push_back(r2msg(cmd));
+        auto start = Time::now();
+        mp.push_back(r2msg(cmd, compress));
+        timings.add(ms_serialize, start);
+        if (w.config != config_version) {
+            multipart_add_config(mp);
+            w.config = config_version;
+            w.heartbeat = heartbeat > 0;
+        }
+        if (chunk.size() != 0) {
+            mp.push_back(zmq::message_t(std::string("chunk:")));
+            mp.push_back(zmq::message_t(0));
+            mp.push_back(std::move(chunk));
+        }
 
-        if (w.via.empty()) {
-            for (auto &str : add_to_worker)
-                multipart_add_obj(mp, str, w.env);
-        } else {
-            std::vector<std::string> proxy_add_env;
-            auto &via_env = peers[w.via].env;
-            for (auto &str : add_to_worker) {
-                w.env.insert(str);
-                if (via_env.find(str) == via_env.end())
-                    multipart_add_obj(mp, str, via_env);
-                else
-                    proxy_add_env.push_back(str);
+        // proxies on the route to the worker, outermost first
+        auto path = route_proxies(w);
+        std::vector<std::vector<uint64_t>> proxy_add_env(path.size());
+        std::vector<size_t> touched(path.size(), 0);
+        std::vector<std::pair<std::string, size_t>> traced_env;
+        // workers that saw the current common data need no per-object checks
+        for (size_t id=0; w.env_version != env_version && id<env_slots.size(); id++) {
+            const auto &kv = env_slots[id];
+            uint64_t prev = id < w.env.size() ? w.env[id] : 0;
+            if (prev == kv.second && env_set[id] <= w.env_version)
+                continue;
+
+            // the worker binds known hashes from its cache, so only send new
+            // ones; the same hash is bound again if the name was set again
+            bool cached = w.objs.find(kv.second) != w.objs.end();
+            bool has_base = prev != 0 && w.bases.find(prev) != w.bases.end();
+            if (prev != kv.second)
+                bind_obj(w, id, kv.second);
+            size_t n_frames = mp.size();
+            if (cached) {
+                multipart_add_ref(mp, kv.first, kv.second);
+                continue;
+            }
+            if (delta >= 0 && uncompressed_size(env[kv.second]) >= static_cast<size_t>(delta))
+                w.bases.insert(kv.second);
+            if (has_base && multipart_add_delta(mp, kv.first, kv.second, prev)) {
+                // the worker patches its previous version
+            } else if (w.local && shm_names.find(kv.second) != shm_names.end()) {
+                mp.push_back(zmq::message_t(kv.first));
+                mp.push_back(hash2msg(kv.second));
+                mp.push_back(shm_header(shm_names[kv.second], env[kv.second].size()));
+            } else if (w.via.empty()) {
+                std::string source;
+                if (broadcast > 0 && fragment > 0 && env[kv.second].size() > static_cast<size_t>(fragment))
+                    source = tree_source(kv.second, cur);
+                multipart_add_obj(mp, kv.first, kv.second, source);
+            } else {
+                // the innermost proxy that caches the object adds it, and
+                // the ones after it cache it as it passes through
+                int from = path.size() - 1;
+                while (from >= 0 && peers[path[from]].objs.find(kv.second) == peers[path[from]].objs.end())
+                    from--;
+                if (from >= 0) {
+                    multipart_add_ref(mp, kv.first, kv.second);
+                    proxy_add_env[from].push_back(kv.second);
+                } else
+                    multipart_add_obj(mp, kv.first, kv.second);
+                for (int i=std::max(from, 0); i<path.size(); i++) {
+                    proxy_touch(peers[path[i]], kv.second);
+                    touched[i]++;
+                }
             }
-            mp.push_back(r2msg(Rcpp::wrap(proxy_add_env)));
+            size_t bytes = 0;
+            for (size_t i=n_frames; i<mp.size(); i++)
+                bytes += mp[i].size();
+            env_sent[kv.first] += bytes;
+            if (tracing)
+                traced_env.emplace_back(kv.first, bytes);
+        }
+        // each proxy takes the last pair of objects to add and to drop
+        for (int i=path.size()-1; i>=0; i--) {
+            mp.push_back(hashes2msg(proxy_add_env[i]));
+            mp.push_back(hashes2msg(proxy_evict(peers[path[i]], touched[i])));
         }
+        w.env_version = env_version;
 
-        w.call = cmd;
-        w.call_ref = ++call_counter;
+        w.calls.push_back(sent_call_t{++call_counter, cmd, Time::now()});
+        for (size_t i=0; i<mp.size(); i++)
+            w.sent += mp[i].size();
+        if (tracing) {
+            auto &c = trace_calls[call_counter];
+            c.worker = z85_encode_routing_id(w.route.back());
+            c.env = std::move(traced_env);
+            c.sent = trace_now();
+        }
+        start = Time::now();
         mp.send(sock);
-        return w.call_ref;
+        timings.add(ms_send, start);
+        return call_counter;
     }
     void send_shutdown() {
         auto &w = check_current_worker(wlife_t::active);
         auto mp = init_multipart(w, wlife_t::shutdown);
-        w.call = R_NilValue;
-        w.status = wlife_t::shutdown;
+        set_status(w, wlife_t::shutdown);
         mp.send(sock);
     }
 
@@ -151,58 +264,384 @@ public:
         std::vector<zmq::message_t> msgs;
         auto n = recv_multipart(sock, std::back_inserter(msgs));
         register_peer(msgs);
-        // msgs[0] == "proxy" routing id
+        // msgs[0] == proxy routing id
         // msgs[1] == delimiter
         // msgs[2] == wlife_t::proxy_cmd
 
+        // the proxy forwards natively, so it gets the heartbeat interval here
         auto &w = check_current_worker(wlife_t::proxy_cmd);
         auto mp = init_multipart(w, wlife_t::proxy_cmd);
-        mp.push_back(r2msg(args));
+        Rcpp::List cmd(args);
+        cmd.push_back(heartbeat, "heartbeat");
+        mp.push_back(r2msg(cmd));
         mp.send(sock);
+        w.heartbeat = heartbeat > 0;
+    }
+
+    // Run all calls of the map in the event loop: send chunks of iter rows as
+    // the first argument of cmd, place results by call ID, and shut down or
+    // keep waiting workers when done; R is only called for progress updates
+    // Up to 'prefetch' chunks are queued at each worker so it does not idle
+    // for a round trip between chunks. If chunk_time is positive, chunks are
+    // sized to take about this many seconds on each worker instead
+    // Chunks held by lost workers are sent again to the remaining ones, which
+    // are parked until all results are in if we can notice lost workers
+    Rcpp::List map(Rcpp::List iter, SEXP cmd, SEXP result, int chunk_size,
+            double chunk_time, bool fail_on_error, double max_calls_worker,
+            bool reuse, int timeout, SEXP progress) {
+        R_xlen_t n_calls = iter.size() > 0 ? Rf_xlength(iter[0]) :
+            Rf_xlength(Rf_getAttrib(iter, R_RowNamesSymbol));
+        Rcpp::RObject job_result = Rf_duplicate(result);
+        Rcpp::List warnings, errors;
+        int n_warnings = 0, n_errors = 0;
+        R_xlen_t submitted = 0, jobs_running = 0, ticks = 0;
+        std::unordered_map<std::string, map_worker_t> running;
+        std::deque<map_chunk_t> requeue;
+        std::vector<std::string> parked; // idle workers without a call
+        int n_lost = 0;
+        timing_t all_workers;
+        bool shutdown = false;
+        auto last_tick = Time::now();
+        chunk_size = std::max(chunk_size, 1);
+        lost.clear();
+
+        while ((!shutdown && (submitted < n_calls || !requeue.empty())) || jobs_running > 0) {
+            Rcpp::RObject msg;
+            try {
+                msg = recv(timeout);
+            } catch (...) {
+                if (lost.empty())
+                    throw;
+                for (const auto &id : lost) {
+                    auto it = running.find(id);
+                    if (it == running.end())
+                        continue;
+                    for (const auto &chunk : it->second.queued) {
+                        jobs_running -= chunk.len;
+                        if (chunk.len > 0)
+                            requeue.push_back(chunk);
+                    }
+                    running.erase(it);
+                }
+                n_lost += lost.size();
+                lost.clear();
+
+                // parked workers are blocked waiting for a call, so give them
+                // the chunks of the lost ones right away
+                while (!shutdown && !requeue.empty() && !parked.empty()) {
+                    cur = parked.back();
+                    parked.pop_back();
+                    if (peers[cur].status != wlife_t::active)
+                        continue;
+                    auto chunk = requeue.front();
+                    requeue.pop_front();
+                    send_chunk(cmd, iter, chunk.start, chunk.len);
+                    chunk.sent = Time::now();
+                    running[cur].queued.push_back(chunk);
+                    jobs_running += chunk.len;
+                }
+                continue;
+            }
+            if (Rf_inherits(msg, "worker_error"))
+                return Rcpp::List::create(Rcpp::_["worker_error"] = msg);
+
+            // a chunk starts when it was sent or the previous one finished
+            auto now = Time::now();
+            auto &mw = running[cur];
+            auto &queued = mw.queued;
+            if (!queued.empty()) {
+                R_xlen_t len = queued.front().len;
+                if (len > 0) {
+                    double t = std::chrono::duration<double>(now -
+                            std::max(queued.front().sent, mw.last)).count();
+                    mw.timing.add(len, t);
+                    all_workers.add(len, t);
+                }
+                jobs_running -= len;
+                ticks += len;
+                queued.pop_front();
+            }
+            mw.last = now;
+            if (TYPEOF(msg) == VECSXP && Rf_xlength(msg) == 3) {
+                Rcpp::List res(msg);
+                if (typed.size() != 0)
+                    map_place_typed(job_result, n_calls);
+                else
+                    map_place(job_result, res["result"], n_calls);
+                n_warnings += map_conditions(warnings, res["warnings"]);
+                n_errors += map_conditions(errors, res["errors"]);
+                if (n_errors > 0 && fail_on_error)
+                    shutdown = true;
+            }
+
+            if (progress != R_NilValue && ticks > 0 && (jobs_running == 0 ||
+                        Time::now() - last_tick > std::chrono::milliseconds(100))) {
+                Rcpp::Function tick(progress);
+                tick(static_cast<double>(ticks));
+                ticks = 0;
+                last_tick = Time::now();
+            }
+
+            const auto &w = peers[cur];
+            while (!shutdown && !requeue.empty() && queued.size() < prefetch &&
+                    w.n_calls + queued.size() < max_calls_worker) {
+                auto chunk = requeue.front();
+                requeue.pop_front();
+                send_chunk(cmd, iter, chunk.start, chunk.len);
+                chunk.sent = Time::now();
+                queued.push_back(chunk);
+                jobs_running += chunk.len;
+            }
+            while (!shutdown && submitted < n_calls && queued.size() < prefetch &&
+                    w.n_calls + queued.size() < max_calls_worker) {
+                R_xlen_t len = chunk_size;
+                if (chunk_time > 0 && !mw.timing.empty())
+                    len = mw.timing.chunk_size(chunk_time, mw.size);
+                else if (chunk_time > 0 && !all_workers.empty())
+                    len = all_workers.chunk_size(chunk_time, chunk_size);
+
+                // adapt chunk size towards end of processing
+                int n_workers = std::max(workers_running(), 1);
+                R_xlen_t remaining = n_calls - submitted;
+                len = std::min(len, static_cast<R_xlen_t>(std::ceil(static_cast<double>(remaining) / n_workers)));
+                len = std::max(len, static_cast<R_xlen_t>(1));
+
+                send_chunk(cmd, iter, submitted, len);
+                queued.push_back(map_chunk_t{submitted, len, Time::now()});
+                mw.size = len;
+                jobs_running += len;
+                submitted += len;
+            }
+
+            // workers with queued chunks will report back again; if we can
+            // notice lost workers, idle ones are parked without a call (they
+            // block until they get one) in case chunks need to be re-sent
+            if (!queued.empty()) {
+                continue;
+            } else if (jobs_running > 0 && detects_loss() && !shutdown &&
+                    w.n_calls < max_calls_worker) {
+                parked.push_back(cur);
+            } else {
+                map_release(reuse && !shutdown && w.n_calls < max_calls_worker);
+            }
+        }
+
+        for (const auto &id : parked) {
+            cur = id;
+            if (peers[cur].status == wlife_t::active)
+                map_release(reuse && !shutdown && peers[cur].n_calls < max_calls_worker);
+        }
+
+        return Rcpp::List::create(
+            Rcpp::_["result"] = job_result,
+            Rcpp::_["n_errors"] = n_errors,
+            Rcpp::_["n_warnings"] = n_warnings,
+            Rcpp::_["warnings"] = warnings,
+            Rcpp::_["errors"] = errors,
+            Rcpp::_["submitted"] = static_cast<double>(submitted),
+            Rcpp::_["lost"] = n_lost
+        );
     }
 
     void add_env(std::string name, SEXP obj) {
-        for (auto &w : peers)
-            w.second.env.erase(name);
-        env_names.insert(name);
-        env[name] = r2msg(R_serialize(obj, R_NilValue));
+        auto start = Time::now();
+        auto msg = r2msg(obj);
+        auto hash = hash64(msg.data(), msg.size());
+        auto it = env_ids.find(name);
+        if (it != env_ids.end()) {
+            auto &slot = env_slots[it->second];
+            env_set[it->second] = ++env_version;
+            if (slot.second == hash) // workers re-bind it from their cache
+                return;
+            auto prev = slot.second;
+            slot.second = hash;
+            env_refs[hash]++;
+            // workers holding the previous version can patch it instead
+            if (delta >= 0 && msg.size() >= static_cast<size_t>(delta) && env.find(hash) == env.end()) {
+                auto d = delta_encode(env.at(prev), prev, msg);
+                if (d.size() != 0 && compress >= 0 && d.size() >= static_cast<size_t>(compress))
+                    d = delta_compress(std::move(d));
+                if (d.size() != 0)
+                    deltas[hash] = std::move(d);
+            }
+            if (--env_refs[prev] == 0) {
+                env_refs.erase(prev);
+                // segments are removed with their message, unless queued
+                // calls may still reference them
+                if (shm_names.erase(prev) > 0 && std::any_of(peers.begin(), peers.end(),
+                            [](const std::pair<const std::string, worker_t> &kv) {
+                            return !kv.second.calls.empty(); }))
+                    shm_retired.push_back(std::move(env[prev]));
+                env.erase(prev);
+                deltas.erase(prev);
+                trees.erase(prev);
+            }
+        } else {
+            env_ids.emplace(name, env_slots.size());
+            env_slots.emplace_back(name, hash);
+            env_refs[hash]++;
+            env_set.push_back(++env_version);
+        }
+
+        if (env.find(hash) != env.end())
+            return;
+        if (compress >= 0 && msg.size() >= static_cast<size_t>(compress))
+            msg = compress_msg(std::move(msg));
+        timings.add(ms_serialize, start);
+        // written once for all workers on this host, and kept instead of msg
+        if (shm >= 0 && has_local && msg.size() >= static_cast<size_t>(shm)) {
+            std::string name;
+            msg = shm_create(hash, std::move(msg), name);
+            if (!name.empty())
+                shm_names[hash] = name;
+        }
+        env.emplace(hash, std::move(msg));
     }
     void add_pkg(Rcpp::CharacterVector pkg) {
         add_env("package:" + Rcpp::as<std::string>(pkg), pkg);
     }
+    // unserializes the common data once for workers forked afterwards, which
+    // are then marked as holding it when they connect
+    Rcpp::List fork_env() {
+        forked_env = env_slots;
+        Rcpp::List objs(env_slots.size());
+        Rcpp::CharacterVector names(env_slots.size());
+        Rcpp::RawVector hashes(env_slots.size() * sizeof(uint64_t));
+        int i = 0;
+        for (const auto &kv : env_slots) {
+            names[i] = kv.first;
+            objs[i] = msg2r(std::move(env[kv.second]), true);
+            memcpy(RAW(hashes) + i * sizeof(uint64_t), &kv.second, sizeof(uint64_t));
+            i++;
+        }
+        objs.names() = names;
+        return Rcpp::List::create(Rcpp::_["objs"] = objs, Rcpp::_["hashes"] = hashes);
+    }
     Rcpp::DataFrame list_env() const {
         std::vector<std::string> names;
-        names.reserve(env.size());
-        std::vector<long> sizes;
-        sizes.reserve(env.size());
-        for (const auto &kv: env) {
+        names.reserve(env_slots.size());
+        std::vector<double> sizes, wire;
+        sizes.reserve(env_slots.size());
+        wire.reserve(env_slots.size());
+        for (const auto &kv: env_slots) {
+            const auto &obj = env.at(kv.second);
             names.push_back(kv.first);
-            sizes.push_back(kv.second.size());
+            sizes.push_back(uncompressed_size(obj));
+            wire.push_back(obj.size());
         }
         return Rcpp::DataFrame::create(Rcpp::_["object"] = Rcpp::wrap(names),
-                Rcpp::_["size"] = Rcpp::wrap(sizes));
+                Rcpp::_["size"] = Rcpp::wrap(sizes),
+                Rcpp::_["compressed"] = Rcpp::wrap(wire));
+    }
+    void set_compress(int threshold) {
+        compress = threshold;
+        ++config_version;
+    }
+    void set_delta(int threshold) {
+        delta = threshold;
+        ++config_version;
+    }
+    // workers keep objects of at least 'threshold' bytes serialized until
+    // they are first used, -1 to unserialize them when received
+    void set_lazy(int threshold) {
+        lazy = threshold;
+        ++config_version;
+    }
+    // workers send their stage timings with each result
+    void set_stats(bool enable) {
+        worker_stats = enable;
+        ++config_version;
+    }
+    // record calls and common data sent to workers for trace()
+    void set_trace(bool enable) {
+        tracing = enable;
+        ++config_version;
+    }
+    // objects of at least 'threshold' bytes are passed to workers connected
+    // via IPC in shared memory, -1 to disable
+    void set_shm(int threshold) {
+        shm = threshold;
+    }
+    void set_prefetch(int depth) {
+        if (depth < 1)
+            Rcpp::stop("Prefetch depth must be at least 1");
+        prefetch = depth;
+    }
+    // fan-out of the tree that fragmented objects are broadcast along, 0 to
+    // send them from the master to each worker. Workers bind their relay on
+    // one of 'ports', only serve peers that know this session's token, and
+    // ask the master instead if a peer did not reply within 'timeout' ms
+    void set_broadcast(int fanout, Rcpp::IntegerVector ports, int timeout) {
+        if (fanout < 0)
+            Rcpp::stop("Broadcast fan-out must not be negative");
+        if (fanout > 0 && ports.size() == 0)
+            Rcpp::stop("Need at least one port for the broadcast relay");
+        if (timeout < 1)
+            Rcpp::stop("Relay timeout must be positive");
+        broadcast = fanout;
+        relay_ports = ports;
+        relay_timeout = timeout;
+        if (relay_token.empty()) {
+            std::random_device rd;
+            const char hex[] = "0123456789abcdef";
+            for (int i=0; i<32; i++)
+                relay_token += hex[rd() % 16];
+        }
+        ++config_version;
+    }
+    // peers send heartbeats every 'interval' ms once they received the config,
+    // and are considered lost after missing 'miss' of them
+    void set_heartbeat(int interval, int miss) {
+        if (interval > 0 && miss < 1)
+            Rcpp::stop("Heartbeat miss count must be at least 1");
+        heartbeat = interval;
+        heartbeat_miss = miss;
+        ++config_version;
+    }
+    void set_fragment(int size) {
+        if (size > 0 && size < 1024)
+            Rcpp::stop("Fragment size must be at least 1024 bytes");
+        fragment = size;
+    }
+
+    // memory limit of the objects each proxy caches, 0 for no limit
+    void set_proxy_cache(double bytes) {
+        proxy_cache = std::isfinite(bytes) && bytes > 0 ? bytes : 0;
     }
 
     void add_pending_workers(int n) {
         pending_workers += n;
     }
+    // the next proxies that request a command start up to 'per_proxy' of
+    // the 'n' workers each
+    void add_proxy_workers(int n, int per_proxy) {
+        if (per_proxy < 1)
+            Rcpp::stop("Proxies need to start at least one worker");
+        proxy_jobs += n;
+        node_workers = per_proxy;
+    }
 
     Rcpp::List list_workers() const {
         std::vector<std::string> names, status;
         std::vector<int> calls;
+        std::vector<double> sent, received;
         names.reserve(peers.size());
         status.reserve(peers.size());
         calls.reserve(peers.size());
+        sent.reserve(peers.size());
+        received.reserve(peers.size());
         Rcpp::List wtime, mem;
         std::string cur_z85;
         for (const auto &kv: peers) {
             if (kv.second.status == wlife_t::proxy_cmd || kv.second.status == wlife_t::error)
                 continue;
-            names.push_back(z85_encode_routing_id(kv.first));
+            names.push_back(z85_encode_routing_id(kv.second.route.empty() ? kv.first : kv.second.route.back()));
             if (kv.first == cur)
                 cur_z85 = names.back();
             status.push_back(std::string(wlife_t2str(kv.second.status)));
             calls.push_back(kv.second.n_calls);
+            sent.push_back(kv.second.sent);
+            received.push_back(kv.second.received);
             wtime.push_back(kv.second.time);
             mem.push_back(kv.second.mem);
         }
@@ -211,6 +650,8 @@ public:
             Rcpp::_["status"] = Rcpp::wrap(status),
             Rcpp::_["current"] = cur_z85,
             Rcpp::_["calls"] = calls,
+            Rcpp::_["sent"] = Rcpp::wrap(sent),
+            Rcpp::_["received"] = Rcpp::wrap(received),
             Rcpp::_["time"] = wtime,
             Rcpp::_["mem"] = mem,
             Rcpp::_["pending"] = pending_workers
@@ -221,7 +662,7 @@ public:
             return Rcpp::List::create();
         const auto &w = peers[cur];
         return Rcpp::List::create(
-            Rcpp::_["worker"] = z85_encode_routing_id(cur),
+            Rcpp::_["worker"] = z85_encode_routing_id(w.route.empty() ? cur : w.route.back()),
             Rcpp::_["status"] = Rcpp::wrap(wlife_t2str(w.status)),
             Rcpp::_["call_ref"] = w.call_ref,
             Rcpp::_["calls"] = w.n_calls,
@@ -230,34 +671,193 @@ public:
         );
     }
     int workers_running() {
-        return std::count_if(peers.begin(), peers.end(), [](const std::pair<std::string, worker_t> &w) { // 'const auto &w' is C++14
-                return w.second.status == wlife_t::active; });
+        return n_active;
+    }
+    // stage timings of the master, and those reported by all workers; bytes
+    // sent to and received from each peer, and sent for each common object
+    Rcpp::List stats() const {
+        stats_t workers(worker_stages);
+        std::vector<std::string> names;
+        std::vector<double> sent, received;
+        for (const auto &kv : peers) {
+            workers.merge(kv.second.stats);
+            names.push_back(z85_encode_routing_id(kv.second.route.empty() ? kv.first : kv.second.route.back()));
+            sent.push_back(kv.second.sent);
+            received.push_back(kv.second.received);
+        }
+        std::vector<std::string> objs;
+        std::vector<double> obj_sent;
+        for (const auto &kv : env_sent) {
+            objs.push_back(kv.first);
+            obj_sent.push_back(kv.second);
+        }
+        return Rcpp::List::create(
+            Rcpp::_["master"] = timings.to_r(),
+            Rcpp::_["workers"] = workers.to_r(),
+            Rcpp::_["peers"] = Rcpp::DataFrame::create(
+                Rcpp::_["worker"] = Rcpp::wrap(names),
+                Rcpp::_["sent"] = Rcpp::wrap(sent),
+                Rcpp::_["received"] = Rcpp::wrap(received),
+                Rcpp::_["stringsAsFactors"] = false),
+            Rcpp::_["env"] = Rcpp::DataFrame::create(
+                Rcpp::_["object"] = Rcpp::wrap(objs),
+                Rcpp::_["sent"] = Rcpp::wrap(obj_sent),
+                Rcpp::_["stringsAsFactors"] = false)
+        );
     }
     int workers_total() {
         return workers_running() + pending_workers;
     }
 
+    // trace-event JSON of the calls and common data sent so far
+    std::string trace() const {
+        std::string res = "{\"traceEvents\":[{\"name\":\"process_name\",\"ph\":\"M\","
+            "\"pid\":1,\"args\":{\"name\":\"clustermq\"}}";
+        for (const auto &ev : trace_events)
+            res += ",\n" + ev;
+        return res + "],\"displayTimeUnit\":\"ms\"}\n";
+    }
+
 private:
+    struct sent_call_t {
+        int ref;
+        Rcpp::RObject cmd;
+        Time::time_point sent;
+    };
     struct worker_t {
-        std::set<std::string> env;
-        Rcpp::RObject call {R_NilValue};
+        std::vector<uint64_t> env; // hash bound to each env slot, 0 if none
+        int env_version {-1};
+        std::unordered_map<uint64_t, int> objs;
+        std::set<uint64_t> bases;
+        std::deque<sent_call_t> calls; // sent, no result yet
         Rcpp::RObject time {R_NilValue};
         Rcpp::RObject mem {R_NilValue};
-        wlife_t status;
-        std::string via;
+        wlife_t status {wlife_t::error};
+        std::vector<std::string> route; // routing ids, proxies first
+        std::string via; // key of the proxy the worker is connected to
         int n_calls {-1};
         int call_ref {-1};
+        int config {0};
+        bool heartbeat {false};
+        bool local {false}; // connected via IPC, can map shared memory
+        Time::time_point last_seen {Time::now()};
+        std::string relay; // address other workers can fetch fragments from
+        std::list<std::pair<uint64_t, size_t>> lru; // proxies: cached objects and sizes
+        double sent {0}; // bytes
+        double received {0};
+        stats_t stats {worker_stages}; // as last reported by the worker
+        double cached {0}; // proxies: bytes cached
+    };
+
+    // exponentially weighted moments of chunk sizes n and their service times
+    // t (seconds), to estimate per-chunk overhead and per-call cost as the
+    // intercept and slope of t ~ n; without variation in n, the overhead is
+    // attributed to the calls
+    struct timing_t {
+        double sw {0}, sn {0}, st {0}, snn {0}, snt {0};
+
+        void add(double n, double t) {
+            const double decay = 0.8;
+            sw = decay * sw + 1;
+            sn = decay * sn + n;
+            st = decay * st + t;
+            snn = decay * snn + n * n;
+            snt = decay * snt + n * t;
+        }
+        bool empty() const {
+            return sw == 0;
+        }
+        double cost() const {
+            double mn = sn / sw, mt = st / sw;
+            double var = snn / sw - mn * mn;
+            if (var > 1e-6 * mn * mn) {
+                double slope = (snt / sw - mn * mt) / var;
+                if (slope > 0)
+                    return slope;
+            }
+            return mt / std::max(mn, 1.0);
+        }
+        double overhead() const {
+            return std::max(0.0, st / sw - cost() * sn / sw);
+        }
+        // calls that take 'target' seconds including overhead, but at least as
+        // many as the overhead takes; grow at most 4x from the previous size
+        R_xlen_t chunk_size(double target, R_xlen_t prev) const {
+            double c = std::max(cost(), 1e-9), o = overhead();
+            double n = std::max(target - o, o) / c;
+            n = std::min(n, 4.0 * std::max(prev, static_cast<R_xlen_t>(1)));
+            return std::max(static_cast<R_xlen_t>(n), static_cast<R_xlen_t>(1));
+        }
+    };
+    struct map_chunk_t {
+        R_xlen_t start;
+        R_xlen_t len; // 0 for waits
+        Time::time_point sent;
+    };
+    struct map_worker_t {
+        std::deque<map_chunk_t> queued;
+        Time::time_point last; // last message received
+        R_xlen_t size {0}; // last chunk size sent
+        timing_t timing;
     };
 
     zmq::context_t *ctx {nullptr};
     bool is_cleaned_up {false};
     int pending_workers {0};
     int call_counter {-1};
+    int compress {-1};
+    int delta {-1};
+    int fragment {-1};
+    size_t prefetch {1};
+    int heartbeat {0};
+    int heartbeat_miss {3};
+    int broadcast {0};
+    Rcpp::IntegerVector relay_ports;
+    int relay_timeout {5000};
+    std::string relay_token;
+    int shm {-1};
+    int lazy {-1};
+    bool worker_stats {false};
+    bool tracing {false};
+    bool has_local {false};
+    double proxy_cache {0};
+    int proxy_jobs {0};
+    int node_workers {1};
+    Time::time_point last_check {Time::now()};
+    Time::time_point last_scan {Time::now()};
+    Time::time_point grace_start {Time::now()};
+    int config_version {0};
     zmq::socket_t sock;
     std::string cur;
     std::unordered_map<std::string, worker_t> peers;
-    std::unordered_map<std::string, zmq::message_t> env;
-    std::set<std::string> env_names;
+    std::vector<std::string> lost; // not yet handled by map()
+    std::unordered_map<uint64_t, zmq::message_t> env;
+    std::unordered_map<std::string, size_t> env_ids; // name -> slot
+    std::vector<std::pair<std::string, uint64_t>> env_slots; // name, hash
+    std::vector<int> env_set; // env_version when each slot was last set
+    std::unordered_map<uint64_t, int> env_refs; // names bound to each hash
+    std::vector<std::pair<std::string, uint64_t>> forked_env;
+    int env_version {0};
+    int n_active {0};
+    int n_proxies {0};
+    std::unordered_map<uint64_t, zmq::message_t> deltas;
+    std::unordered_map<uint64_t, std::string> shm_names;
+    std::vector<zmq::message_t> shm_retired;
+    zmq::message_t typed; // typed result frame of the last recv()
+    stats_t timings {master_stages};
+    std::unordered_map<std::string, double> env_sent; // bytes by object name
+    struct trace_call_t {
+        std::string worker; // z85 id
+        int64_t sent;
+        double start {-1}; // first row of the chunk, if any
+        double len {0};
+        std::vector<std::pair<std::string, size_t>> env; // objects and bytes sent
+    };
+    std::unordered_map<int, trace_call_t> trace_calls; // by call ref, no result yet
+    std::unordered_map<std::string, int> trace_tids; // track of each worker
+    std::vector<std::string> trace_events;
+    int trace_id {0};
+    std::unordered_map<uint64_t, std::vector<std::pair<std::string, int>>> trees; // node, children
 
     worker_t &check_current_worker(const wlife_t status) {
         if (peers.find(cur) == peers.end())
@@ -269,19 +869,360 @@ private:
     }
     zmq::multipart_t init_multipart(const worker_t &w, const wlife_t status) const {
         zmq::multipart_t mp;
-        if (!w.via.empty())
-            mp.push_back(zmq::message_t(w.via));
-        mp.push_back(zmq::message_t(cur));
+        for (const auto &id : w.route)
+            mp.push_back(zmq::message_t(id));
         mp.push_back(zmq::message_t(0));
         mp.push_back(int2msg(status));
         return mp;
     }
 
-    void multipart_add_obj(zmq::multipart_t &mp, std::string str, std::set<std::string> &tracker) {
-        auto &obj = env[str];
-        tracker.insert(str);
-        mp.push_back(zmq::message_t(str));
-        mp.push_back(zmq::message_t(obj.data(), obj.size(), [](void*, void*){}));
+    // Peers are keyed by the concatenation of their routing ids, so the key
+    // of a proxy is a prefix of the keys of all peers behind it
+    static bool is_behind(const std::string &key, const std::string &proxy) {
+        return key.size() > proxy.size() && key.compare(0, proxy.size(), proxy) == 0;
+    }
+    static std::vector<std::string> routing_ids(const std::vector<zmq::message_t> &msgs, const int n) {
+        std::vector<std::string> route;
+        route.reserve(n);
+        for (int i=0; i<n; i++)
+            route.push_back(msgs[i].to_string());
+        return route;
+    }
+    std::vector<std::string> route_proxies(const worker_t &w) const {
+        std::vector<std::string> keys;
+        std::string key;
+        for (size_t i=0; i+1<w.route.size(); i++) {
+            key += w.route[i];
+            keys.push_back(key);
+        }
+        return keys;
+    }
+
+    // proxies cache all objects they forward in full, which we track to drop
+    // the least recently used ones if they hold more than 'proxy_cache' bytes
+    void proxy_touch(worker_t &p, const uint64_t hash) {
+        auto it = std::find_if(p.lru.begin(), p.lru.end(),
+                [hash](const std::pair<uint64_t, size_t> &obj) { return obj.first == hash; });
+        if (it != p.lru.end()) {
+            p.lru.splice(p.lru.end(), p.lru, it);
+            return;
+        }
+        size_t size = env[hash].size();
+        p.objs[hash] = 1;
+        p.lru.emplace_back(hash, size);
+        p.cached += size;
+    }
+    // the last 'keep' objects are needed for the current call
+    std::vector<uint64_t> proxy_evict(worker_t &p, const size_t keep) {
+        std::vector<uint64_t> drop;
+        while (proxy_cache > 0 && p.cached > proxy_cache && p.lru.size() > keep) {
+            drop.push_back(p.lru.front().first);
+            p.cached -= p.lru.front().second;
+            p.objs.erase(p.lru.front().first);
+            p.lru.pop_front();
+        }
+        return drop;
+    }
+
+    // plain columns are sent in a columnar frame, anything else is
+    // serialized as part of the call
+    void send_chunk(SEXP cmd, const Rcpp::List &iter, const R_xlen_t start, const R_xlen_t len) {
+        auto t0 = Time::now();
+        auto msg = columnar_encode(iter, start, len);
+        int ref;
+        if (msg.size() == 0) {
+            ref = send_eval(map_call(cmd, map_chunk(iter, start, len)));
+        } else {
+            if (compress >= 0 && msg.size() >= static_cast<size_t>(compress))
+                msg = compress_msg(std::move(msg));
+            timings.add(ms_serialize, t0);
+            ref = send_call(map_call(cmd, R_NilValue), std::move(msg));
+        }
+        auto it = trace_calls.find(ref);
+        if (it != trace_calls.end()) {
+            it->second.start = start;
+            it->second.len = len;
+        }
+    }
+    // rows [start, start+len) of each column, and their call IDs
+    SEXP map_chunk(const Rcpp::List &iter, const R_xlen_t start, const R_xlen_t len) const {
+        Rcpp::CharacterVector iter_names(Rf_getAttrib(iter, R_NamesSymbol));
+        Rcpp::List chunk(iter.size() + 1);
+        Rcpp::CharacterVector names(iter.size() + 1);
+        for (R_xlen_t i=0; i<iter.size(); i++) {
+            chunk[i] = subset_rows(iter[i], start, len);
+            names[i] = iter_names[i];
+        }
+        Rcpp::IntegerVector ids(len);
+        for (R_xlen_t i=0; i<len; i++)
+            ids[i] = start + i + 1;
+        chunk[iter.size()] = ids;
+        names[iter.size()] = " id ";
+        chunk.names() = names;
+        return chunk;
+    }
+    static SEXP subset_rows(SEXP x, const R_xlen_t start, const R_xlen_t len) {
+        if (OBJECT(x) && !Rf_inherits(x, "factor")) { // dispatch on class
+            Rcpp::Function subset("[");
+            Rcpp::NumericVector idx(len);
+            for (R_xlen_t i=0; i<len; i++)
+                idx[i] = start + i + 1;
+            return subset(x, idx);
+        }
+
+        Rcpp::RObject res = Rf_allocVector(TYPEOF(x), len);
+        switch(TYPEOF(x)) {
+            case LGLSXP: std::copy_n(LOGICAL(x) + start, len, LOGICAL(res)); break;
+            case INTSXP: std::copy_n(INTEGER(x) + start, len, INTEGER(res)); break;
+            case REALSXP: std::copy_n(REAL(x) + start, len, REAL(res)); break;
+            case CPLXSXP: std::copy_n(COMPLEX(x) + start, len, COMPLEX(res)); break;
+            case RAWSXP: std::copy_n(RAW(x) + start, len, RAW(res)); break;
+            case STRSXP:
+                for (R_xlen_t i=0; i<len; i++)
+                    SET_STRING_ELT(res, i, STRING_ELT(x, start + i));
+                break;
+            case VECSXP:
+                for (R_xlen_t i=0; i<len; i++)
+                    SET_VECTOR_ELT(res, i, VECTOR_ELT(x, start + i));
+                break;
+            default:
+                Rcpp::stop("Can not iterate over vector of type " +
+                        std::string(Rf_type2char(TYPEOF(x))));
+        }
+        SEXP names = Rf_getAttrib(x, R_NamesSymbol);
+        if (names != R_NilValue) {
+            Rcpp::RObject sub_names = subset_rows(names, start, len);
+            Rf_setAttrib(res, R_NamesSymbol, sub_names);
+        }
+        if (OBJECT(x)) {
+            Rf_setAttrib(res, R_LevelsSymbol, Rf_getAttrib(x, R_LevelsSymbol));
+            Rf_setAttrib(res, R_ClassSymbol, Rf_getAttrib(x, R_ClassSymbol));
+        }
+        return res;
+    }
+    static SEXP map_call(SEXP cmd, SEXP chunk) {
+        Rcpp::ExpressionVector expr(1);
+        Rcpp::RObject args = Rf_cons(chunk, CDDR(cmd));
+        expr[0] = Rf_lcons(CAR(cmd), args);
+        return expr;
+    }
+    // typed results are unnamed and cover a range of call IDs; if they have
+    // the type of the result vector, they are copied without an R object
+    void map_place_typed(Rcpp::RObject &job_result, const R_xlen_t n_calls) {
+        if (typed_result_copy(typed, job_result)) {
+            typed = zmq::message_t();
+            return;
+        }
+        R_xlen_t start;
+        Rcpp::RObject value = typed_result_decode(typed, start);
+        typed = zmq::message_t();
+        if (value == R_NilValue)
+            Rcpp::stop("Malformed typed result");
+        value = map_coerce(job_result, value);
+        R_xlen_t n = Rf_xlength(value);
+        if (start < 0 || start + n > n_calls)
+            Rcpp::stop("Invalid call ID in result");
+        switch(TYPEOF(job_result)) {
+            case LGLSXP: std::copy_n(LOGICAL(value), n, LOGICAL(job_result) + start); break;
+            case INTSXP: std::copy_n(INTEGER(value), n, INTEGER(job_result) + start); break;
+            case REALSXP: std::copy_n(REAL(value), n, REAL(job_result) + start); break;
+            case CPLXSXP: std::copy_n(COMPLEX(value), n, COMPLEX(job_result) + start); break;
+            case STRSXP:
+                for (R_xlen_t i=0; i<n; i++)
+                    SET_STRING_ELT(job_result, start + i, STRING_ELT(value, i));
+                break;
+            default:
+                for (R_xlen_t i=0; i<n; i++)
+                    SET_VECTOR_ELT(job_result, start + i, VECTOR_ELT(value, i));
+        }
+    }
+    // without heartbeats or disconnect notifications, lost workers only show
+    // up as a timeout
+    bool detects_loss() const {
+        #ifdef ZMQ_BUILD_DRAFT_API
+        return true;
+        #else
+        return heartbeat > 0;
+        #endif
+    }
+    // idle workers of a reusable pool wait for the next call, others shut down
+    void map_release(bool wait) {
+        if (wait) {
+            Rcpp::ExpressionVector expr(1);
+            expr[0] = Rcpp::Language("Sys.sleep", 0.05);
+            send_eval(expr);
+        } else {
+            send_shutdown();
+        }
+    }
+    // results are named by call ID, and atomic results may coerce the vector
+    static void map_place(Rcpp::RObject &job_result, SEXP res, const R_xlen_t n_calls) {
+        if (res == R_NilValue)
+            return;
+        Rcpp::RObject value = map_coerce(job_result, res);
+        SEXP ids = Rf_getAttrib(value, R_NamesSymbol);
+        if (ids == R_NilValue && Rf_xlength(value) > 0)
+            Rcpp::stop("Result without call IDs");
+        for (R_xlen_t i=0; i<Rf_xlength(value); i++) {
+            const char *id = CHAR(STRING_ELT(ids, i));
+            char *end;
+            R_xlen_t idx = std::strtol(id, &end, 10) - 1;
+            if (end == id || *end != '\0' || idx < 0 || idx >= n_calls)
+                Rcpp::stop("Invalid call ID in result");
+            switch(TYPEOF(job_result)) {
+                case LGLSXP: LOGICAL(job_result)[idx] = LOGICAL(value)[i]; break;
+                case INTSXP: INTEGER(job_result)[idx] = INTEGER(value)[i]; break;
+                case REALSXP: REAL(job_result)[idx] = REAL(value)[i]; break;
+                case CPLXSXP: COMPLEX(job_result)[idx] = COMPLEX(value)[i]; break;
+                case STRSXP: SET_STRING_ELT(job_result, idx, STRING_ELT(value, i)); break;
+                default: SET_VECTOR_ELT(job_result, idx, VECTOR_ELT(value, i));
+            }
+        }
+    }
+    // atomic results may coerce the vector, and are coerced to its type
+    static SEXP map_coerce(Rcpp::RObject &job_result, SEXP res) {
+        auto rank = [](SEXPTYPE type) {
+            switch(type) {
+                case LGLSXP: return 0;
+                case INTSXP: return 1;
+                case REALSXP: return 2;
+                case CPLXSXP: return 3;
+                case STRSXP: return 4;
+                default: return 5;
+            }
+        };
+        Rcpp::RObject value = res;
+        if (rank(TYPEOF(value)) > rank(TYPEOF(job_result)))
+            job_result = Rf_coerceVector(job_result, rank(TYPEOF(value)) == 5 ? VECSXP : TYPEOF(value));
+        if (TYPEOF(value) != TYPEOF(job_result))
+            value = Rf_coerceVector(value, TYPEOF(job_result));
+        return value;
+    }
+    // keep the first 50 condition messages (named by call ID), return count
+    static int map_conditions(Rcpp::List &conds, SEXP msgs) {
+        R_xlen_t n = Rf_xlength(msgs);
+        SEXP ids = Rf_getAttrib(msgs, R_NamesSymbol);
+        for (R_xlen_t i=0; i<n && conds.size()<50; i++)
+            conds.push_back(VECTOR_ELT(msgs, i), ids == R_NilValue ? "" : CHAR(STRING_ELT(ids, i)));
+        return n;
+    }
+
+    void bind_obj(worker_t &w, const size_t id, const uint64_t hash) {
+        if (id >= w.env.size())
+            w.env.resize(env_slots.size(), 0);
+        auto &bound = w.env[id];
+        if (bound != 0 && --w.objs[bound] == 0) {
+            w.objs.erase(bound);
+            w.bases.erase(bound);
+        }
+        bound = hash;
+        w.objs[hash]++;
+    }
+    void multipart_add_obj(zmq::multipart_t &mp, const std::string &name, const uint64_t hash,
+            const std::string &source="") {
+        auto &obj = env[hash];
+        mp.push_back(zmq::message_t(name));
+        mp.push_back(hash2msg(hash));
+        if (fragment > 0 && obj.size() > static_cast<size_t>(fragment))
+            mp.push_back(fragment_header(obj.size(), fragment, source));
+        else
+            mp.push_back(zmq::message_t(obj.data(), obj.size(), [](void*, void*){}));
+    }
+    bool multipart_add_delta(zmq::multipart_t &mp, const std::string &name,
+            const uint64_t hash, const uint64_t base) {
+        auto it = deltas.find(hash);
+        if (it == deltas.end() || delta_base(it->second) != base)
+            return false;
+        mp.push_back(zmq::message_t(name));
+        mp.push_back(hash2msg(hash));
+        mp.push_back(zmq::message_t(it->second.data(), it->second.size(), [](void*, void*){}));
+        return true;
+    }
+    void multipart_add_ref(zmq::multipart_t &mp, const std::string &name, const uint64_t hash) {
+        mp.push_back(zmq::message_t(name));
+        mp.push_back(hash2msg(hash));
+        mp.push_back(zmq::message_t(0));
+    }
+
+    // Fragmented objects are broadcast along a tree: the master and each worker
+    // serve at most 'broadcast' others, filled in the order workers joined, and
+    // workers relay fragments as soon as they received them. If no node has
+    // capacity left, the least loaded worker is used. Returns the relay
+    // address to fetch from, or an empty string for the master
+    std::string tree_source(const uint64_t hash, const std::string &id) {
+        auto &nodes = trees[hash];
+        if (nodes.empty())
+            nodes.emplace_back("", 0); // master
+        std::pair<std::string, int> *source = nullptr, *least = nullptr;
+        for (auto &node : nodes) {
+            if (!node.first.empty()) {
+                auto it = peers.find(node.first);
+                if (node.first == id || it == peers.end() || it->second.status != wlife_t::active)
+                    continue;
+                if (least == nullptr || node.second < least->second)
+                    least = &node;
+            }
+            if (node.second < broadcast) {
+                source = &node;
+                break;
+            }
+        }
+        if (source == nullptr)
+            source = least != nullptr ? least : &nodes[0];
+        source->second++;
+        std::string addr = source->first.empty() ? "" : peers[source->first].relay;
+        if (!peers[id].relay.empty())
+            nodes.emplace_back(id, 0);
+        return addr;
+    }
+
+    // reply to a worker fetching fragments: hash, index of first fragment, and
+    // up to the requested number of fragments
+    void send_fragments(worker_t &w, const std::vector<zmq::message_t> &msgs, int i) {
+        if (msgs.size() < i+3)
+            Rcpp::stop("Invalid fragment request");
+        auto hash = msg2hash(msgs[i]);
+        auto first = msg2int(msgs[i+1]);
+        auto n = msg2int(msgs[i+2]);
+        auto mp = init_multipart(w, wlife_t::fetch);
+        mp.push_back(hash2msg(hash));
+        mp.push_back(int2msg(first));
+        auto it = env.find(hash);
+        if (it != env.end() && fragment > 0) {
+            auto data = static_cast<char*>(it->second.data());
+            size_t size = it->second.size();
+            for (size_t off=static_cast<size_t>(first) * fragment; n-- > 0 && off < size; off+=fragment)
+                mp.push_back(zmq::message_t(data + off, std::min(size - off, static_cast<size_t>(fragment)),
+                            [](void*, void*){}));
+        }
+        double bytes = 0;
+        for (size_t j=0; j<mp.size(); j++)
+            bytes += mp[j].size();
+        w.sent += bytes;
+        for (const auto &kv : env_slots) {
+            if (kv.second == hash) {
+                env_sent[kv.first] += bytes;
+                if (tracing)
+                    trace_event("fragments", "env", "\"ph\":\"i\",\"s\":\"t\"",
+                            trace_tid(z85_encode_routing_id(w.route.back())), trace_now(),
+                            "{\"object\":" + json_str(kv.first) + ",\"bytes\":" + std::to_string(bytes) + "}");
+                break;
+            }
+        }
+        mp.send(sock);
+    }
+
+    void multipart_add_config(zmq::multipart_t &mp) {
+        mp.push_back(zmq::message_t(std::string("config:")));
+        mp.push_back(zmq::message_t(0));
+        mp.push_back(r2msg(Rcpp::List::create(Rcpp::_["compress"] = compress,
+                        Rcpp::_["delta"] = delta, Rcpp::_["lazy"] = lazy,
+                        Rcpp::_["heartbeat"] = heartbeat,
+                        Rcpp::_["broadcast"] = broadcast,
+                        Rcpp::_["relay"] = Rcpp::List::create(Rcpp::_["ports"] = relay_ports,
+                            Rcpp::_["timeout"] = relay_timeout, Rcpp::_["token"] = relay_token),
+                        Rcpp::_["stats"] = worker_stats,
+                        Rcpp::_["trace"] = tracing)));
     }
 
     int poll(int timeout=-1) {
@@ -295,8 +1236,12 @@ private:
 
         int rc = 0;
         do {
+            check_heartbeats();
+            auto slice = time_left;
+            if (heartbeat > 0 && (slice.count() < 0 || slice.count() > heartbeat))
+                slice = std::chrono::milliseconds(heartbeat);
             try {
-                rc = zmq::poll(pitems, time_left);
+                rc = zmq::poll(pitems, slice);
             } catch (zmq::error_t const &e) {
                 if (errno != EINTR || pending_interrupt())
                     Rcpp::stop(e.what());
@@ -314,43 +1259,204 @@ private:
             }
         } while (rc == 0);
 
+        timings.add(ms_wait, start);
         return timeout;
     }
 
+    // Each worker has its own track: evaluation is a complete event, and
+    // sending a call, waiting on the worker and returning the result are
+    // async slices, as well as the common data sent with it. Times from the
+    // worker's clock are kept in order with the master's
+    void trace_result(const worker_t &w, const call_times_t &times) {
+        auto it = trace_calls.find(w.call_ref);
+        if (it == trace_calls.end())
+            return;
+        const auto &c = it->second;
+        int tid = trace_tid(c.worker);
+        std::string args = "{\"worker\":" + json_str(c.worker) + ",\"call_ref\":" +
+            std::to_string(w.call_ref);
+        if (c.len > 0)
+            args += ",\"start\":" + std::to_string(static_cast<int64_t>(c.start) + 1) +
+                ",\"len\":" + std::to_string(static_cast<int64_t>(c.len));
+        args += "}";
+
+        int64_t received = std::max(c.sent, times.received);
+        int64_t eval_start = std::max(received, times.eval_start);
+        int64_t eval_end = std::max(eval_start, times.eval_end);
+        int64_t returned = std::max(eval_end, trace_now());
+        trace_async("send", "call", tid, c.sent, received, args);
+        for (const auto &obj : c.env)
+            trace_async(obj.first, "env", tid, c.sent, received, "{\"call_ref\":" +
+                    std::to_string(w.call_ref) + ",\"bytes\":" + std::to_string(obj.second) + "}");
+        trace_async("queued", "call", tid, received, eval_start, args);
+        trace_event("eval", "call", "\"ph\":\"X\",\"dur\":" + std::to_string(eval_end - eval_start),
+                tid, eval_start, args);
+        trace_async("reply", "call", tid, eval_end, returned, args);
+        trace_calls.erase(it);
+    }
+    void trace_async(const std::string &name, const char *cat, const int tid,
+            const int64_t begin, const int64_t end, const std::string &args) {
+        std::string id = "\"id\":" + std::to_string(++trace_id);
+        trace_event(name, cat, "\"ph\":\"b\"," + id, tid, begin, args);
+        trace_event(name, cat, "\"ph\":\"e\"," + id, tid, end, "{}");
+    }
+    void trace_event(const std::string &name, const char *cat, const std::string &phase,
+            const int tid, const int64_t ts, const std::string &args) {
+        trace_events.push_back("{\"name\":" + json_str(name) + ",\"cat\":\"" + cat + "\"," +
+                phase + ",\"pid\":1,\"tid\":" + std::to_string(tid) + ",\"ts\":" +
+                std::to_string(ts) + ",\"args\":" + args + "}");
+    }
+    int trace_tid(const std::string &worker) {
+        auto it = trace_tids.find(worker);
+        if (it != trace_tids.end())
+            return it->second;
+        int tid = trace_tids.size() + 1;
+        trace_tids.emplace(worker, tid);
+        trace_events.push_back("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" +
+                std::to_string(tid) + ",\"args\":{\"name\":" + json_str(worker) + "}}");
+        return tid;
+    }
+
+    // Status changes go through here to keep the number of active workers
+    // and proxies without counting all peers
+    void set_status(worker_t &w, const wlife_t status) {
+        n_active += (status == wlife_t::active) - (w.status == wlife_t::active);
+        n_proxies += (status == wlife_t::proxy_cmd) - (w.status == wlife_t::proxy_cmd);
+        w.status = status;
+    }
+
+    // Marks a peer and the peers connected through it as lost, and raises an
+    // error; map() catches it to send the calls they held to other workers.
+    // Peers already lost were handled before, so nothing happens for them
+    void peer_lost(const std::string &id, const char *reason) {
+        auto &p = peers[id];
+        if (p.status == wlife_t::lost)
+            return;
+        bool is_proxy = p.status == wlife_t::proxy_cmd;
+        set_status(p, wlife_t::lost);
+        p.calls.clear();
+        lost.push_back(id);
+        for (auto &kv : peers) {
+            if (is_proxy && is_behind(kv.first, id) && (kv.second.status == wlife_t::active ||
+                        kv.second.status == wlife_t::proxy_cmd)) {
+                set_status(kv.second, wlife_t::lost);
+                kv.second.calls.clear();
+                lost.push_back(kv.first);
+            }
+        }
+        Rcpp::stop(reason);
+    }
+
+    // Peers that stopped sending heartbeats are marked as lost. If we did not
+    // poll for longer than an interval, queued heartbeats were not read yet,
+    // so all peers get another full period. Peers are only scanned once per
+    // interval, which is the resolution of their heartbeats anyway
+    void check_heartbeats() {
+        if (heartbeat <= 0)
+            return;
+        auto now = Time::now();
+        auto interval = std::chrono::milliseconds(heartbeat);
+        if (now - last_check > 2 * interval)
+            grace_start = now;
+        last_check = now;
+        if (now - last_scan < interval)
+            return;
+        last_scan = now;
+        for (auto &kv : peers) {
+            auto &w = kv.second;
+            if (!w.heartbeat || now - std::max(w.last_seen, grace_start) <= heartbeat_miss * interval ||
+                    (w.status != wlife_t::active && w.status != wlife_t::proxy_cmd))
+                continue;
+            cur = kv.first;
+            if (w.status == wlife_t::proxy_cmd)
+                peer_lost(kv.first, "Proxy lost (no heartbeat)");
+            else
+                peer_lost(kv.first, "Worker lost (no heartbeat)");
+        }
+    }
+
     int register_peer(std::vector<zmq::message_t> &msgs) {
 //        std::cout << "Received message: ";
 //        for (int i=0; i<msgs.size(); i++)
 //            std::cout << msgs[i].size() << " ";
 //        std::cout << "\n";
 
-        int cur_i = 0;
-        if (msgs[1].size() != 0)
-            ++cur_i;
-
-        cur = msgs[cur_i].to_string();
+        // routing ids of (possibly nested) proxies precede the peer's own
+        int cur_i = find_delimiter(msgs);
+        if (cur_i >= msgs.size())
+            Rcpp::stop("No frame delimiter found");
+        if (cur_i == 0)
+            Rcpp::stop("No routing id found before frame delimiter");
+        // the key is built in place, and the route only for new peers
+        auto now = Time::now();
+        cur.clear();
+        for (int i=0; i<cur_i-1; i++) {
+            cur.append(static_cast<const char*>(msgs[i].data()), msgs[i].size());
+            auto &p = peers[cur];
+            p.last_seen = now;
+            if (p.route.empty()) { // proxy that did not request a command
+                set_status(p, wlife_t::proxy_cmd);
+                p.route = routing_ids(msgs, i+1);
+            }
+        }
+        size_t via_size = cur.size();
+        cur.append(static_cast<const char*>(msgs[cur_i-1].data()), msgs[cur_i-1].size());
         int prev_size = peers.size();
         auto &w = peers[cur];
-        w.call = R_NilValue;
-        if (cur_i == 1)
-            w.via = msgs[0].to_string();
+        w.last_seen = now;
+        for (const auto &msg : msgs)
+            w.received += msg.size();
+        if (w.route.empty()) {
+            w.via = cur.substr(0, via_size);
+            w.route = routing_ids(msgs, cur_i);
+        }
 
-        if (msgs[++cur_i].size() != 0)
-            Rcpp::stop("No frame delimiter found at expected position");
+        // the calls of lost peers were sent to others, so anything they send
+        // later, including results and disconnects, is dropped
+        if (w.status == wlife_t::lost)
+            return msgs.size();
+
+        if (msgs.size() > cur_i+1 && msg2wlife_t(msgs[cur_i+1]) == wlife_t::heartbeat)
+            return msgs.size();
+
+        // workers report their relay address once, and can serve the
+        // fragmented objects they are fetching to others
+        if (msgs.size() > cur_i+2 && msg2wlife_t(msgs[cur_i+1]) == wlife_t::relay) {
+            w.relay = msgs[cur_i+2].to_string();
+            for (const auto &obj : w.objs) {
+                auto it = trees.find(obj.first);
+                if (it != trees.end())
+                    it->second.emplace_back(cur, 0);
+            }
+            return msgs.size();
+        }
+
+        // fragment requests are served while the worker keeps its call
+        if (msgs.size() > cur_i+1 && msg2wlife_t(msgs[cur_i+1]) == wlife_t::fetch) {
+            send_fragments(w, msgs, cur_i+2);
+            return msgs.size();
+        }
 
         // handle status frame if present, else it's a disconnect notification
+        // results arrive in the order the calls were sent to the worker
         if (msgs.size() > ++cur_i) {
-            w.status = msg2wlife_t(msgs[cur_i]);
+            set_status(w, msg2wlife_t(msgs[cur_i]));
             w.n_calls++;
+            if (!w.calls.empty()) {
+                w.call_ref = w.calls.front().ref;
+                timings.add(ms_roundtrip, w.calls.front().sent);
+                w.calls.pop_front();
+            }
         } else {
             if (w.status == wlife_t::proxy_cmd) {
                 for (const auto &w: peers) {
-                    if (w.second.via == cur && w.second.status == wlife_t::active)
-                        Rcpp::stop("Proxy disconnect with active worker(s)");
+                    if (is_behind(w.first, cur) && w.second.status == wlife_t::active)
+                        peer_lost(cur, "Proxy disconnect with active worker(s)");
                 }
             } else if (w.status == wlife_t::shutdown) {
-                w.status = wlife_t::finished;
+                set_status(w, wlife_t::finished);
             } else
-                Rcpp::stop("Unexpected worker disconnect");
+                peer_lost(cur, "Unexpected worker disconnect");
         }
 
         if (peers.size() > prev_size && w.status == wlife_t::active) {
@@ -358,10 +1464,36 @@ private:
                 Rcpp::stop("More workers registered than expected");
         }
 
+        // proxies submitted by a qsys get their share of workers to start;
+        // nested proxies get theirs from the proxy they connect to
+        if (peers.size() > prev_size && w.status == wlife_t::proxy_cmd) {
+            if (w.route.size() == 1 && proxy_jobs > 0) {
+                int n = std::min(proxy_jobs, node_workers);
+                proxy_jobs -= n;
+                auto mp = init_multipart(w, wlife_t::proxy_cmd);
+                mp.push_back(r2msg(Rcpp::List::create(Rcpp::_["n_jobs"] = n,
+                                Rcpp::_["heartbeat"] = heartbeat)));
+                mp.send(sock);
+                w.heartbeat = heartbeat > 0;
+            } else if (w.route.size() > 1) {
+                w.heartbeat = heartbeat > 0;
+            }
+        }
+
         if (msgs.size() > cur_i+2) {
             w.time = msg2r(std::move(msgs[++cur_i]), true);
             w.mem = msg2r(std::move(msgs[++cur_i]), true);
         }
+        // the first message of a worker ends with flags whether it connected
+        // via IPC, and whether it was forked with the common data
+        if (w.n_calls == 1 && msgs.size() > cur_i+2 && w.route.size() == 1) {
+            int flags = msg2int(msgs[cur_i+2]);
+            w.local = flags & 1;
+            if (flags & 2) {
+                for (size_t id=0; id<forked_env.size(); id++)
+                    bind_obj(w, id, forked_env[id].second);
+            }
+        }
         return ++cur_i;
     }
 };
@@ -11,7 +11,10 @@ RCPP_MODULE(cmq_proxy) {
         .method("proxy_request_cmd", &CMQProxy::proxy_request_cmd)
         .method("proxy_receive_cmd", &CMQProxy::proxy_receive_cmd)
         .method("add_pending_workers", &CMQProxy::add_pending_workers)
+        .method("add_proxy_workers", &CMQProxy::add_proxy_workers)
         .method("close", &CMQProxy::close)
         .method("process_one", &CMQProxy::process_one)
+        .method("start", &CMQProxy::start)
+        .method("wait", &CMQProxy::wait)
     ;
 }
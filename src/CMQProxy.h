@@ -12,6 +12,16 @@ public:
     ~CMQProxy() { close(); }
 
     void close(int timeout=1000L) {
+        if (fwd_thread.joinable()) {
+            ctl.send(zmq::message_t(0), zmq::send_flags::none);
+            fwd_thread.join();
+        }
+        for (auto s : {&ctl, &ctl_peer}) {
+            if (s->handle() != nullptr) {
+                s->set(zmq::sockopt::linger, 0);
+                s->close();
+            }
+        }
         if (mon.handle() != nullptr) {
             mon.set(zmq::sockopt::linger, 0);
             mon.close();
@@ -34,7 +44,6 @@ public:
     void connect(std::string addr, int timeout=-1) {
         to_master = zmq::socket_t(*ctx, ZMQ_DEALER);
         to_master.set(zmq::sockopt::connect_timeout, timeout);
-        to_master.set(zmq::sockopt::routing_id, "proxy");
 
         if (zmq_socket_monitor(to_master, "inproc://monitor", ZMQ_EVENT_DISCONNECTED) < 0)
             Rcpp::stop("failed to create socket monitor");
@@ -49,17 +58,36 @@ public:
         to_master.send(int2msg(wlife_t::proxy_cmd), zmq::send_flags::sndmore);
         to_master.send(r2msg(proc_time()), zmq::send_flags::sndmore);
         to_master.send(r2msg(mem_stats()), zmq::send_flags::none);
+        last_sent = Time::now();
     }
+    // the heartbeat interval is for us, the other arguments for the qsys
     SEXP proxy_receive_cmd() {
         std::vector<zmq::message_t> msgs;
         auto n = recv_multipart(to_master, std::back_inserter(msgs));
         auto status = msg2wlife_t(msgs[1]);
-        return msg2r(std::move(msgs[2]), true);
+        Rcpp::List args = msg2r(std::move(msgs[2]), true);
+        if (args.containsElementNamed("heartbeat")) {
+            heartbeat = Rcpp::as<int>(args["heartbeat"]);
+            args.erase(args.findName("heartbeat"));
+        }
+        return args;
     }
 
     void add_pending_workers(int n) {
         // proxy will always wait
     }
+    // proxies connecting to us request a command, and get up to 'per_proxy'
+    // of the 'n' workers each; serialized here as forwarding has no R access
+    void add_proxy_workers(int n, int per_proxy) {
+        if (per_proxy < 1)
+            Rcpp::stop("Proxies need to start at least one worker");
+        if (fwd_thread.joinable())
+            Rcpp::stop("Proxy workers need to be added before forwarding starts");
+        for (; n > 0; n -= per_proxy)
+            proxy_cmds.push_back(r2msg(Rcpp::List::create(
+                    Rcpp::_["n_jobs"] = std::min(n, per_proxy),
+                    Rcpp::_["heartbeat"] = heartbeat)));
+    }
 
     std::string listen(Rcpp::CharacterVector addrs) {
         to_worker = zmq::socket_t(*ctx, ZMQ_ROUTER);
@@ -82,7 +110,84 @@ public:
         Rcpp::stop("Could not bind port to any address in provided pool");
     }
 
+    // forward messages of one event from R, e.g. for testing
     bool process_one() {
+        if (fwd_thread.joinable())
+            Rcpp::stop("Proxy is already forwarding in a separate thread");
+        try {
+            return forward(true);
+        } catch (std::exception const &e) {
+            Rcpp::stop(e.what());
+        }
+    }
+
+    // Forwarding runs in a native thread, so it does not wait for R, and we
+    // only need to wait for it to finish (when the master disconnects)
+    void start() {
+        if (fwd_thread.joinable())
+            Rcpp::stop("Proxy is already forwarding in a separate thread");
+        auto addr = "inproc://proxy-ctl-" + std::to_string(reinterpret_cast<uintptr_t>(this));
+        ctl = zmq::socket_t(*ctx, ZMQ_PAIR);
+        ctl_peer = zmq::socket_t(*ctx, ZMQ_PAIR);
+        ctl_peer.bind(addr);
+        ctl.connect(addr);
+        fwd_thread = std::thread(&CMQProxy::fwd_loop, this);
+    }
+    bool wait(int timeout=-1) {
+        if (!fwd_thread.joinable())
+            Rcpp::stop("Proxy is not forwarding in a separate thread");
+        auto pitems = std::vector<zmq::pollitem_t>(1);
+        pitems[0].socket = ctl;
+        pitems[0].events = ZMQ_POLLIN;
+        try {
+            if (zmq::poll(pitems, std::chrono::milliseconds(timeout)) == 0)
+                return true;
+        } catch (zmq::error_t const &e) {
+            if (errno != EINTR || pending_interrupt())
+                Rcpp::stop(e.what());
+            return true;
+        }
+
+        std::vector<zmq::message_t> msgs;
+        recv_multipart(ctl, std::back_inserter(msgs));
+        fwd_thread.join();
+        if (msg2wlife_t(msgs[0]) == wlife_t::error)
+            Rcpp::stop(msgs.size() > 1 ? msgs[1].to_string() : "Proxy forwarding failed");
+        return false;
+    }
+
+private:
+    Rcpp::Function proc_time {"proc.time"};
+    bool external_context {true};
+    zmq::context_t *ctx {nullptr};
+    zmq::socket_t to_master;
+    zmq::socket_t to_worker;
+    zmq::socket_t mon;
+    zmq::socket_t ctl; // R end of the forwarding thread control pipe
+    zmq::socket_t ctl_peer; // forwarding thread end
+    std::thread fwd_thread;
+    int heartbeat {0};
+    std::deque<zmq::message_t> proxy_cmds;
+    Time::time_point last_sent {Time::now()};
+    std::unordered_map<uint64_t, zmq::message_t> env;
+    std::unordered_map<uint64_t, std::vector<zmq::message_t>> fragments;
+
+    // reports how forwarding ended on the control pipe
+    void fwd_loop() {
+        std::string err;
+        try {
+            while (forward(false));
+        } catch (std::exception const &e) {
+            err = e.what();
+        }
+        ctl_peer.send(int2msg(err.empty() ? wlife_t::finished : wlife_t::error), zmq::send_flags::sndmore);
+        ctl_peer.send(zmq::message_t(err), zmq::send_flags::none);
+    }
+
+    // Polls until there is a message and forwards it, returns false if the
+    // master disconnected or (in the thread) we were asked to stop. Only zmq
+    // and no R API calls unless called from R ('interruptible')
+    bool forward(bool interruptible) {
         auto pitems = std::vector<zmq::pollitem_t>(3);
         pitems[0].socket = to_master;
         pitems[0].events = ZMQ_POLLIN;
@@ -90,56 +195,93 @@ public:
         pitems[1].events = ZMQ_POLLIN;
         pitems[2].socket = mon;
         pitems[2].events = ZMQ_POLLIN;
+        if (!interruptible)
+            pitems.push_back(zmq::pollitem_t{ctl_peer.handle(), 0, ZMQ_POLLIN, 0});
 
-        auto time_left = std::chrono::milliseconds(-1);
+        // the master sees forwarded worker messages, so only heartbeat if idle
         int rc = 0;
         do {
+            auto time_left = std::chrono::milliseconds(heartbeat > 0 ? heartbeat : -1);
             try {
                 rc = zmq::poll(pitems, time_left);
             } catch (zmq::error_t const &e) {
-                if (errno != EINTR || pending_interrupt())
-                    Rcpp::stop(e.what());
+                if (errno != EINTR || (interruptible && pending_interrupt()))
+                    throw;
+            }
+            if (heartbeat > 0 && Time::now() - last_sent >= std::chrono::milliseconds(heartbeat)) {
+                to_master.send(zmq::message_t(0), zmq::send_flags::sndmore);
+                to_master.send(int2msg(wlife_t::heartbeat), zmq::send_flags::none);
+                last_sent = Time::now();
             }
         } while (rc == 0);
+        if (pitems.size() > 3 && pitems[3].revents > 0)
+            return false;
 
         // master to worker communication -> add R env objects
-        // frames: id, delim, status, call, [objs{1..n},] env_add
+        // frames: ids, delim, status, call, [objs{1..n}: name, hash, data,]
+        // and an env_add, env_drop pair of hashes for each proxy on the route
+        // (ours last)
         if (pitems[0].revents > 0) {
             std::vector<zmq::message_t> msgs;
             auto n = recv_multipart(to_master, std::back_inserter(msgs));
-            std::vector<std::string> add_from_proxy;
-            if (msgs.size() >= 5) {
-                add_from_proxy = Rcpp::as<std::vector<std::string>>(msg2r(std::move(msgs.back()), true));
+            int d = delimiter(msgs);
+            if (msgs.size() > d+3 && msg2wlife_t(msgs[d+1]) == wlife_t::fetch) {
+                forward_fragments(msgs, d);
+                return true;
+            }
+            std::set<uint64_t> add_from_proxy;
+            std::vector<uint64_t> drop;
+            int objs_end = msgs.size();
+            if (msgs.size() >= d+5 && msg2wlife_t(msgs[d+1]) == wlife_t::active) {
+                drop = msg2hashes(msgs.back());
                 msgs.pop_back();
+                auto add = msg2hashes(msgs.back());
+                add_from_proxy.insert(add.begin(), add.end());
+                msgs.pop_back();
+                objs_end = msgs.size() - 2 * (d-1); // pairs of proxies behind us
             }
 
+            // frames are moved, and cached objects share their buffer with
+            // the frames in flight (reference-counted by zmq_msg_copy)
             zmq::multipart_t mp;
-            for (int i=0; i<msgs.size(); i++) {
-                mp.push_back(zmq::message_t(msgs[i].data(), msgs[i].size()));
-                if (i >= 4) {
-                    auto name = msgs[i++].to_string();
-                    mp.push_back(zmq::message_t(msgs[i].data(), msgs[i].size()));
-                    env[name] = zmq::message_t(msgs[i].data(), msgs[i].size());
+            for (int i=0; i<msgs.size() && i<d+3; i++)
+                mp.push_back(std::move(msgs[i]));
+            for (int i=d+3; i+2<objs_end; i+=3) {
+                auto hash = msg2hash(msgs[i+1]);
+                if (msgs[i+1].size() != 0 && add_from_proxy.find(hash) != add_from_proxy.end()) {
+                    msgs[i+2] = share(env[hash]);
+                } else if (msgs[i+2].size() != 0 && msgs[i+1].size() != 0 && !is_delta(msgs[i+2])) {
+                    env[hash] = share(msgs[i+2]);
                 }
+                for (int j=i; j<i+3; j++)
+                    mp.push_back(std::move(msgs[j]));
             }
+            for (int i=std::max(objs_end, d+3); i<msgs.size(); i++)
+                mp.push_back(std::move(msgs[i]));
 
-//            std::cout << "adding from proxy env: (" << add_from_proxy.size() << ")";
-            for (auto &name : add_from_proxy) {
-                mp.push_back(zmq::message_t(name));
-                mp.push_back(zmq::message_t(env[name].data(), env[name].size(), [](void*, void*){}));
-            }
 //            std::cout << "\nMESSAGE SIZE to worker: " << mp.size() << "\n\n";
             mp.send(to_worker);
+            for (const auto &hash : drop) {
+                env.erase(hash);
+                fragments.erase(hash);
+            }
         }
 
         // worker to master communication -> simple forward
+        // (unless fetching fragments the proxy already has)
         if (pitems[1].revents > 0) {
             std::vector<zmq::message_t> msgs;
             auto n = recv_multipart(to_worker, std::back_inserter(msgs));
+            int d = delimiter(msgs);
+            if (msgs.size() > d+4 && msg2wlife_t(msgs[d+1]) == wlife_t::fetch && reply_fragments(msgs, d))
+                return true;
+            if (msgs.size() > d+1 && msg2wlife_t(msgs[d+1]) == wlife_t::proxy_cmd && d == 1)
+                send_proxy_cmd(msgs[0]);
             zmq::multipart_t mp;
             for (int i=0; i<msgs.size(); i++)
                 mp.push_back(std::move(msgs[i]));
             mp.send(to_master);
+            last_sent = Time::now();
         }
 
         if (pitems[2].revents > 0)
@@ -148,12 +290,67 @@ public:
         return true;
     }
 
-private:
-    Rcpp::Function proc_time {"proc.time"};
-    bool external_context {true};
-    zmq::context_t *ctx {nullptr};
-    zmq::socket_t to_master;
-    zmq::socket_t to_worker;
-    zmq::socket_t mon;
-    std::unordered_map<std::string, zmq::message_t> env;
+    static int delimiter(const std::vector<zmq::message_t> &msgs) {
+        size_t d = find_delimiter(msgs);
+        if (d >= msgs.size())
+            throw std::runtime_error("No frame delimiter found");
+        return d;
+    }
+
+    static zmq::message_t share(zmq::message_t &msg) {
+        zmq::message_t res;
+        res.copy(msg);
+        return res;
+    }
+
+    // proxies behind us get their share of our workers to start
+    void send_proxy_cmd(const zmq::message_t &id) {
+        if (proxy_cmds.empty())
+            return;
+        zmq::multipart_t mp;
+        mp.push_back(zmq::message_t(id.data(), id.size()));
+        mp.push_back(zmq::message_t(0));
+        mp.push_back(int2msg(wlife_t::proxy_cmd));
+        mp.push_back(std::move(proxy_cmds.front()));
+        proxy_cmds.pop_front();
+        mp.send(to_worker);
+    }
+
+    // frames: ids, delim, status, hash, first index, fragments
+    void forward_fragments(std::vector<zmq::message_t> &msgs, const int d) {
+        auto &cached = fragments[msg2hash(msgs[d+2])];
+        size_t first = msg2int(msgs[d+3]);
+        if (cached.size() < first + msgs.size() - d-4)
+            cached.resize(first + msgs.size() - d-4);
+        zmq::multipart_t mp;
+        for (int i=0; i<msgs.size(); i++) {
+            if (i >= d+4)
+                cached[first+i-d-4] = share(msgs[i]);
+            mp.push_back(std::move(msgs[i]));
+        }
+        mp.send(to_worker);
+    }
+    // frames: ids, delim, status, hash, first index, number of fragments
+    bool reply_fragments(std::vector<zmq::message_t> &msgs, const int d) {
+        auto it = fragments.find(msg2hash(msgs[d+2]));
+        if (it == fragments.end())
+            return false;
+        size_t first = msg2int(msgs[d+3]);
+        size_t n = msg2int(msgs[d+4]);
+        auto &cached = it->second;
+        if (cached.size() < first + n)
+            return false;
+        for (size_t i=first; i<first+n; i++) {
+            if (cached[i].size() == 0)
+                return false;
+        }
+
+        zmq::multipart_t mp;
+        for (int i=0; i<d+4; i++)
+            mp.push_back(std::move(msgs[i]));
+        for (size_t i=first; i<first+n; i++)
+            mp.push_back(share(cached[i]));
+        mp.send(to_worker);
+        return true;
+    }
 };
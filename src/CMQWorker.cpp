@@ -1,14 +1,21 @@
 #include <Rcpp.h>
 #include "CMQWorker.h"
 
+// [[Rcpp::export]]
+SEXP lazy_obj(SEXP ptr) {
+    return Rcpp::XPtr<lazy_obj_t>(ptr)->get();
+}
+
 RCPP_MODULE(cmq_worker) {
     using namespace Rcpp;
     class_<CMQWorker>("CMQWorker")
         .constructor()
         .constructor<SEXP>()
+        .method("preload", &CMQWorker::preload)
         .method("connect", &CMQWorker::connect)
         .method("close", &CMQWorker::close)
         .method("poll", &CMQWorker::poll)
         .method("process_one", &CMQWorker::process_one)
+        .method("stats", &CMQWorker::stats)
     ;
 }
@@ -1,6 +1,28 @@
 #include <Rcpp.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
 #include "common.h"
 #include "memory.h"
+#include "shm.h"
+#include "stats.h"
+#include "trace.h"
+
+// serialized object that is unserialized when its binding is first accessed
+struct lazy_obj_t {
+    zmq::message_t msg;
+    Rcpp::RObject obj;
+    bool done {false};
+
+    SEXP get() {
+        if (!done) {
+            obj = msg2r(std::move(msg), true);
+            msg = zmq::message_t();
+            done = true;
+        }
+        return obj;
+    }
+};
 
 class CMQWorker {
 public:
@@ -11,7 +33,8 @@ public:
     ~CMQWorker() { close(); }
 
     void connect(std::string addr, int timeout=5000) {
-        sock = zmq::socket_t(*ctx, ZMQ_REQ);
+        // DEALER so the master can queue further calls while one is evaluated
+        sock = zmq::socket_t(*ctx, ZMQ_DEALER);
         // timeout would need ZMQ_RECONNECT_STOP_CONN_REFUSED (draft, no C++ yet) to work
         sock.set(zmq::sockopt::connect_timeout, timeout);
         sock.set(zmq::sockopt::immediate, 1);
@@ -26,16 +49,47 @@ public:
         try {
             sock.connect(addr);
             check_send_ready(timeout);
+            sock.send(zmq::message_t(0), zmq::send_flags::sndmore);
             sock.send(int2msg(wlife_t::active), zmq::send_flags::sndmore);
             sock.send(r2msg(proc_time()), zmq::send_flags::sndmore);
             sock.send(r2msg(mem_stats()), zmq::send_flags::sndmore);
-            sock.send(r2msg(R_NilValue), zmq::send_flags::none);
+            sock.send(r2msg(R_NilValue), zmq::send_flags::sndmore);
+            int flags = (addr.compare(0, 6, "ipc://") == 0) | (preloaded << 1);
+            sock.send(int2msg(flags), zmq::send_flags::none);
+            start_io();
         } catch (zmq::error_t const &e) {
             Rcpp::stop(e.what());
         }
     }
 
+    // common data held by the parent when this worker was forked, so the
+    // master does not send it again; call before connect
+    void preload(Rcpp::List forked) {
+        auto objs = Rcpp::as<Rcpp::List>(forked["objs"]);
+        auto hashes = Rcpp::as<Rcpp::RawVector>(forked["hashes"]);
+        if (objs.size() > 0) {
+            auto names = Rcpp::as<Rcpp::CharacterVector>(objs.names());
+            for (R_xlen_t i=0; i<objs.size(); i++) {
+                uint64_t hash;
+                memcpy(&hash, RAW(hashes) + i * sizeof(uint64_t), sizeof(hash));
+                cache[hash].obj = objs[i];
+                bind_obj(Rcpp::as<std::string>(names[i]), hash);
+            }
+        }
+        preloaded = true;
+    }
+
     void close() {
+        if (io_thread.joinable()) {
+            io.send(zmq::message_t(0), zmq::send_flags::none); // after queued results
+            io_thread.join();
+        }
+        for (auto s : {&io, &io_peer}) {
+            if (s->handle() != nullptr) {
+                s->set(zmq::sockopt::linger, 0);
+                s->close();
+            }
+        }
         if (mon.handle() != nullptr) {
             mon.set(zmq::sockopt::linger, 0);
             mon.close();
@@ -52,13 +106,13 @@ public:
     }
 
     void poll() {
-        auto pitems = std::vector<zmq::pollitem_t>(2);
-        pitems[0].socket = sock;
+        if (!backlog.empty())
+            return;
+        auto start = Time::now();
+        auto pitems = std::vector<zmq::pollitem_t>(1);
+        pitems[0].socket = io;
         pitems[0].events = ZMQ_POLLIN;
-        pitems[1].socket = mon;
-        pitems[1].events = ZMQ_POLLIN;
 
-        int total_sock_ev = 0;
         do {
             try {
                 zmq::poll(pitems, std::chrono::milliseconds{-1});
@@ -66,15 +120,21 @@ public:
                 if (errno != EINTR || pending_interrupt())
                     Rcpp::stop(e.what());
             }
-            if (pitems[1].revents > 0)
-                Rcpp::stop("Unexpected peer disconnect");
-            total_sock_ev = pitems[0].revents;
-        } while (total_sock_ev == 0);
+        } while (pitems[0].revents == 0);
+        timings.add(ws_wait, start);
     }
 
     bool process_one() {
         std::vector<zmq::message_t> msgs;
-        auto n = recv_multipart(sock, std::back_inserter(msgs));
+        if (backlog.empty()) {
+            msgs = recv_call();
+        } else {
+            msgs = std::move(backlog.front());
+            backlog.pop_front();
+        }
+        auto start = Time::now();
+        for (const auto &msg : msgs)
+            received += msg.size();
 
 //        std::cout << "Received message: ";
 //        for (int i=0; i<msgs.size(); i++)
@@ -87,16 +147,51 @@ public:
             close();
             return false;
         }
-        for (auto it=msgs.begin()+3; it<msgs.end(); it+=2) {
-            std::string name = (it-1)->to_string();
-            if (name.compare(0, 8, "package:") == 0)
-                load_pkg(name.substr(8, std::string::npos));
-            else
-                env.assign(name, msg2r(std::move(*it), true));
+        call_times_t times;
+        times.received = msg2time(msgs.back()); // added by the I/O thread
+        msgs.pop_back();
+        // env objects: name, content hash, and data (empty if cached)
+        Rcpp::RObject chunk;
+        for (int i=2; i+2<msgs.size(); i+=3) {
+            std::string name = msgs[i].to_string();
+            if (name == "config:") {
+                set_config(msg2r(std::move(msgs[i+2]), true));
+                continue;
+            }
+            if (name == "chunk:") {
+                chunk = columnar_decode(msgs[i+2]);
+                if (chunk == R_NilValue)
+                    Rcpp::stop("Malformed columnar chunk");
+                continue;
+            }
+            auto hash = msg2hash(msgs[i+1]);
+            if (is_delta(msgs[i+2]))
+                msgs[i+2] = apply_delta(name, msgs[i+2]);
+            if (is_fragmented(msgs[i+2])) {
+                fetch_obj(hash, msgs[i+2]);
+            } else if (msgs[i+2].size() != 0) {
+                auto &c = cache[hash];
+                size_t size = uncompressed_size(msgs[i+2]);
+                if (lazy >= 0 && size >= static_cast<size_t>(lazy) && name.compare(0, 8, "package:") != 0) {
+                    auto obj = new lazy_obj_t;
+                    obj->msg.copy(msgs[i+2]); // shares the buffer with the delta base
+                    c.lazy = Rcpp::XPtr<lazy_obj_t>(obj, true);
+                } else
+                    c.obj = msg2r(std::move(msgs[i+2]), true);
+                if (delta >= 0 && size >= static_cast<size_t>(delta))
+                    c.base = std::move(msgs[i+2]);
+            } else if (cache.find(hash) == cache.end())
+                Rcpp::stop("Object reference not found in worker cache: " + name);
+            bind_obj(name, hash);
         }
 
         SEXP cmd, eval, time, mem;
         PROTECT(cmd = msg2r(std::move(msgs[1]), true));
+        if (chunk != R_NilValue) // first argument of the call
+            SETCADR(VECTOR_ELT(cmd, 0), chunk);
+        timings.add(ws_unserialize, start);
+        start = Time::now();
+        times.eval_start = trace_now();
         int err = 0;
         PROTECT(eval = R_tryEvalSilent(Rcpp::as<Rcpp::List>(cmd)[0], env, &err));
         if (err) {
@@ -105,24 +200,592 @@ public:
             UNPROTECT(1);
             PROTECT(eval = wrap_error(cmd));
         }
+        timings.add(ws_eval, start);
+        times.eval_end = trace_now();
+        start = Time::now();
+        std::vector<zmq::message_t> res;
+        res.push_back(int2msg(wlife_t::active));
+        zmq::message_t typed;
+        if (!err && chunk != R_NilValue)
+            typed = typed_result(eval, chunk);
         PROTECT(time = proc_time());
         PROTECT(mem = mem_stats());
-        sock.send(int2msg(wlife_t::active), zmq::send_flags::sndmore);
-        sock.send(r2msg(time), zmq::send_flags::sndmore);
-        sock.send(r2msg(mem), zmq::send_flags::sndmore);
-        sock.send(r2msg(eval), zmq::send_flags::none);
+        res.push_back(r2msg(time));
+        res.push_back(r2msg(mem));
+        res.push_back(r2msg(eval)); // this and the next compressed by I/O thread
+        if (typed.size() != 0)
+            res.push_back(std::move(typed));
         UNPROTECT(4);
+        timings.add(ws_serialize, start);
+        start = Time::now();
+        for (const auto &msg : res)
+            sent += msg.size();
+        if (send_stats)
+            res.push_back(timings.encode(sent, received));
+        if (send_trace)
+            res.push_back(trace_encode(times));
+        send_multipart(io, res);
+        timings.add(ws_reply, start);
         return true;
     }
 
+    // stage timings, bytes sent to and received from the master, and how
+    // many lazy objects were not unserialized yet
+    Rcpp::List stats() const {
+        int pending = 0;
+        for (const auto &kv : cache) {
+            if (kv.second.lazy != R_NilValue && !Rcpp::XPtr<lazy_obj_t>(kv.second.lazy)->done)
+                pending++;
+        }
+        auto res = timings.to_r();
+        res.push_back(static_cast<double>(sent), "sent");
+        res.push_back(static_cast<double>(received), "received");
+        res.push_back(pending, "lazy");
+        return res;
+    }
+
 private:
     bool external_context {true};
+    bool preloaded {false};
     zmq::context_t *ctx {nullptr};
     zmq::socket_t sock;
     zmq::socket_t mon;
+    zmq::socket_t io; // main thread end of the pipe to the I/O thread
+    zmq::socket_t io_peer; // I/O thread end
+    std::thread io_thread;
     Rcpp::Environment env {1};
     Rcpp::Function load_pkg {"library"};
+    Rcpp::Function delayed_assign {"delayedAssign"};
     Rcpp::Function proc_time {"proc.time"};
+    std::atomic<int> compress {-1};
+    std::atomic<int> heartbeat {0};
+    int delta {-1};
+    int lazy {-1};
+    bool send_stats {false};
+    bool send_trace {false};
+    stats_t timings {worker_stages};
+    uint64_t sent {0}; // bytes
+    uint64_t received {0};
+    const int fetch_credits {2};
+    struct cached_t {
+        Rcpp::RObject obj;
+        Rcpp::RObject lazy; // lazy_obj_t pointer, instead of obj
+        zmq::message_t base; // serialized copy to apply deltas to
+        int refs {0};
+    };
+    std::unordered_map<std::string, uint64_t> env_hash;
+    std::unordered_map<uint64_t, cached_t> cache;
+    std::deque<std::vector<zmq::message_t>> backlog; // calls queued during fetch
+
+    // broadcast relay, only used by the I/O thread
+    int relay_timeout {5000}; // ms
+    std::string relay_token; // sent with requests to peers, and checked
+    struct relayed_t {
+        std::vector<zmq::message_t> frags; // empty if not received yet
+        std::vector<std::vector<zmq::message_t>> waiting; // peer requests
+    };
+    struct upstream_t {
+        std::string addr; // empty if the master was asked instead
+        int first;
+        int n;
+        Time::time_point sent;
+    };
+    bool relay_bound {false}; // main thread
+    zmq::socket_t relay;
+    std::unordered_map<uint64_t, relayed_t> relayed;
+    std::unordered_map<std::string, zmq::socket_t> upstream_socks;
+    std::unordered_map<uint64_t, upstream_t> upstream;
+    std::set<std::string> failed_upstream;
+    Time::time_point io_last_sent;
+
+    // next message from the I/O thread, which strips the delimiter frame
+    std::vector<zmq::message_t> recv_call() {
+        std::vector<zmq::message_t> msgs;
+        auto n = recv_multipart(io, std::back_inserter(msgs));
+        if (msg2int(msgs[0]) == wlife_t::error)
+            Rcpp::stop(msgs.size() > 1 ? msgs[1].to_string() : "Worker I/O failed");
+        return msgs;
+    }
+
+    // Network I/O runs in a separate thread, so the next call is received and
+    // the previous result is sent while R evaluates. Frames are (de)compressed
+    // there, but all R objects are (un)serialized on the main thread
+    void start_io() {
+        auto addr = "inproc://worker-io-" + std::to_string(reinterpret_cast<uintptr_t>(this));
+        io = zmq::socket_t(*ctx, ZMQ_PAIR);
+        io_peer = zmq::socket_t(*ctx, ZMQ_PAIR);
+        for (auto s : {&io, &io_peer}) { // never block the other thread
+            s->set(zmq::sockopt::sndhwm, 0);
+            s->set(zmq::sockopt::rcvhwm, 0);
+        }
+        io_peer.bind(addr);
+        io.connect(addr);
+        io_thread = std::thread(&CMQWorker::io_loop, this);
+    }
+
+    // only zmq and codec calls here, no R API; heartbeats are sent if nothing
+    // else was sent to the master for an interval, also while R is evaluating
+    void io_loop() {
+        io_last_sent = Time::now();
+        try {
+            while (true) {
+                auto pitems = std::vector<zmq::pollitem_t>(3);
+                pitems[0].socket = sock;
+                pitems[0].events = ZMQ_POLLIN;
+                pitems[1].socket = mon;
+                pitems[1].events = ZMQ_POLLIN;
+                pitems[2].socket = io_peer;
+                pitems[2].events = ZMQ_POLLIN;
+                std::vector<zmq::socket_t*> socks;
+                if (relay.handle() != nullptr)
+                    socks.push_back(&relay);
+                for (auto &kv : upstream_socks)
+                    socks.push_back(&kv.second);
+                for (auto s : socks)
+                    pitems.push_back(zmq::pollitem_t{s->handle(), 0, ZMQ_POLLIN, 0});
+
+                int hb = heartbeat;
+                int wait = hb > 0 ? hb : -1;
+                if (!upstream.empty() && (wait < 0 || wait > 1000))
+                    wait = 1000;
+                try {
+                    zmq::poll(pitems, std::chrono::milliseconds{wait});
+                } catch (zmq::error_t const &e) {
+                    if (errno == EINTR)
+                        continue;
+                    throw;
+                }
+                if (hb > 0 && Time::now() - io_last_sent >= std::chrono::milliseconds(hb)) {
+                    // skip if the master does not read, the queue shows we are alive
+                    if (sock.send(zmq::message_t(0), zmq::send_flags::sndmore | zmq::send_flags::dontwait))
+                        sock.send(int2msg(wlife_t::heartbeat), zmq::send_flags::none);
+                    io_last_sent = Time::now();
+                }
+
+                if (pitems[0].revents > 0)
+                    io_from_master();
+                if (pitems[2].revents > 0 && !io_from_main())
+                    break;
+                for (size_t i=0; i<socks.size(); i++) {
+                    if (pitems[i+3].revents == 0)
+                        continue;
+                    if (socks[i] == &relay)
+                        relay_request();
+                    else
+                        io_from_upstream(*socks[i]);
+                }
+                for (auto it = upstream.begin(); it != upstream.end();) {
+                    if (Time::now() - it->second.sent > std::chrono::milliseconds(relay_timeout))
+                        it = fetch_fallback(it);
+                    else
+                        ++it;
+                }
+
+                if (pitems[1].revents > 0 && pitems[0].revents == 0) // drained
+                    throw std::runtime_error("Unexpected peer disconnect");
+            }
+        } catch (std::exception const &e) {
+            io_peer.send(int2msg(wlife_t::error), zmq::send_flags::sndmore);
+            io_peer.send(zmq::message_t(std::string(e.what())), zmq::send_flags::none);
+        }
+
+        for (auto s : {&relay}) {
+            if (s->handle() != nullptr) {
+                s->set(zmq::sockopt::linger, 0);
+                s->close();
+            }
+        }
+        for (auto &kv : upstream_socks) {
+            kv.second.set(zmq::sockopt::linger, 0);
+            kv.second.close();
+        }
+        upstream_socks.clear();
+    }
+
+    void io_from_master() {
+        std::vector<zmq::message_t> msgs;
+        recv_multipart(sock, std::back_inserter(msgs));
+        if (msgs.size() < 2 || msgs[0].size() != 0)
+            throw std::runtime_error("No frame delimiter found at expected position");
+        msgs.erase(msgs.begin());
+        auto status = msg2int(msgs[0]);
+        if (status == wlife_t::active) {
+            msgs[1] = decompress_msg(std::move(msgs[1]));
+            for (size_t i=4; i<msgs.size(); i+=3) {
+                if (is_shm(msgs[i])) {
+                    msgs[i] = shm_map(msgs[i]);
+                    if (msgs[i].size() == 0)
+                        throw std::runtime_error("Could not map shared memory object");
+                }
+                msgs[i] = decompress_msg(std::move(msgs[i]));
+                if (is_fragmented(msgs[i])) // relay may be bound by this call
+                    relay_expect(msg2hash(msgs[i-1]), msgs[i]);
+            }
+            msgs.push_back(time2msg(trace_now())); // taken off by process_one
+
+        } else if (status == wlife_t::fetch && msgs.size() > 3) {
+            relay_add(msgs);
+            // a request that fell back to the master is no longer pending
+            auto it = upstream.find(msg2hash(msgs[1]));
+            if (it != upstream.end() && it->second.addr.empty())
+                upstream.erase(it);
+        }
+        send_multipart(io_peer, msgs);
+    }
+
+    // returns false if the main thread closes the worker
+    bool io_from_main() {
+        std::vector<zmq::message_t> msgs;
+        recv_multipart(io_peer, std::back_inserter(msgs));
+        if (msgs[0].size() == 0)
+            return false;
+        auto status = msg2int(msgs[0]);
+        if (status == wlife_t::relay) {
+            relay_control(msgs);
+            return true;
+        }
+        if (status == wlife_t::fetch && msgs.size() == 5) { // with relay address
+            fetch_upstream(msgs);
+            return true;
+        }
+        int c = compress;
+        for (size_t i=3; status == wlife_t::active && c >= 0 && i < msgs.size() && i < 5; i++) {
+            if (msgs[i].size() >= static_cast<size_t>(c))
+                msgs[i] = compress_msg(std::move(msgs[i]));
+        }
+        sock.send(zmq::message_t(0), zmq::send_flags::sndmore);
+        send_multipart(sock, msgs);
+        io_last_sent = Time::now();
+        return true;
+    }
+
+    // frames: relay, command ("bind" with node name, token, timeout, and
+    // ports; or "drop" with hash). The relay is bound on the node name like
+    // the master does, and not at all if none of the ports is available
+    void relay_control(std::vector<zmq::message_t> &msgs) {
+        auto cmd = msgs[1].to_string();
+        if (cmd == "bind" && relay.handle() == nullptr) {
+            relay_token = msgs[3].to_string();
+            relay_timeout = msg2int(msgs[4]);
+            auto first = static_cast<const int*>(msgs[5].data());
+            std::vector<int> ports(first, first + msgs[5].size() / sizeof(int));
+            std::shuffle(ports.begin(), ports.end(), std::mt19937(std::random_device()()));
+            if (ports.size() > 100)
+                ports.resize(100);
+
+            std::string addr;
+            relay = zmq::socket_t(*ctx, ZMQ_ROUTER);
+            for (auto port : ports) {
+                try {
+                    addr = "tcp://" + msgs[2].to_string() + ":" + std::to_string(port);
+                    relay.bind(addr);
+                    break;
+                } catch (zmq::error_t const &e) {
+                    addr.clear();
+                }
+            }
+            if (addr.empty()) {
+                relay.set(zmq::sockopt::linger, 0);
+                relay.close();
+                return;
+            }
+            sock.send(zmq::message_t(0), zmq::send_flags::sndmore);
+            sock.send(int2msg(wlife_t::relay), zmq::send_flags::sndmore);
+            sock.send(zmq::message_t(addr), zmq::send_flags::none);
+            io_last_sent = Time::now();
+        } else if (cmd == "drop") {
+            auto it = relayed.find(msg2hash(msgs[2]));
+            if (it == relayed.end())
+                return;
+            auto waiting = std::move(it->second.waiting);
+            relayed.erase(it);
+            for (auto &req : waiting) // reply that we do not have it
+                relay_serve(req);
+        }
+    }
+
+    // fragments of objects this worker fetches are kept to serve to others
+    void relay_expect(const uint64_t hash, const zmq::message_t &header) {
+        uint64_t size, frag_size;
+        fragment_info(header, size, frag_size);
+        auto &obj = relayed[hash];
+        if (obj.frags.empty() && frag_size > 0)
+            obj.frags.resize((size + frag_size - 1) / frag_size);
+    }
+    // frames: fetch, hash, first index, fragments
+    void relay_add(std::vector<zmq::message_t> &msgs) {
+        auto it = relayed.find(msg2hash(msgs[1]));
+        if (relay.handle() == nullptr || it == relayed.end())
+            return;
+        auto &frags = it->second.frags;
+        size_t first = msg2int(msgs[2]);
+        for (size_t i=3; i<msgs.size() && first+i-3 < frags.size(); i++)
+            frags[first+i-3].copy(msgs[i]); // shares the buffer
+        auto waiting = std::move(it->second.waiting);
+        it->second.waiting.clear();
+        for (auto &req : waiting)
+            relay_serve(req);
+    }
+    // requests without this session's token are dropped
+    void relay_request() {
+        std::vector<zmq::message_t> req;
+        recv_multipart(relay, std::back_inserter(req));
+        if (req.size() != 7 || req[6].to_string() != relay_token)
+            return;
+        req.pop_back();
+        relay_serve(req);
+    }
+    // frames: id, delim, fetch, hash, first index, number of fragments; waits
+    // for fragments we are still fetching, and replies without any if we do
+    // not have the object so the peer asks the master instead
+    void relay_serve(std::vector<zmq::message_t> &req) {
+        auto it = relayed.find(msg2hash(req[3]));
+        size_t first = msg2int(req[4]);
+        size_t last = first;
+        if (it != relayed.end()) {
+            auto &frags = it->second.frags;
+            last = std::min(first + msg2int(req[5]), frags.size());
+            for (size_t i=first; i<last; i++) {
+                if (frags[i].size() == 0) {
+                    it->second.waiting.push_back(std::move(req));
+                    return;
+                }
+            }
+        }
+        std::vector<zmq::message_t> reply;
+        for (int i=0; i<5; i++)
+            reply.push_back(std::move(req[i]));
+        for (size_t i=first; i<last; i++) {
+            reply.emplace_back();
+            reply.back().copy(it->second.frags[i]);
+        }
+        send_multipart(relay, reply);
+    }
+
+    // frames: fetch, hash, first index, number, relay address of the peer
+    void fetch_upstream(std::vector<zmq::message_t> &msgs) {
+        auto addr = msgs[4].to_string();
+        msgs.pop_back();
+        auto hash = msg2hash(msgs[1]);
+        upstream[hash] = upstream_t{addr, msg2int(msgs[2]), msg2int(msgs[3]), Time::now()};
+        if (failed_upstream.find(addr) != failed_upstream.end()) {
+            fetch_fallback(upstream.find(hash));
+            return;
+        }
+        auto &s = upstream_socks[addr];
+        try {
+            if (s.handle() == nullptr) {
+                s = zmq::socket_t(*ctx, ZMQ_DEALER);
+                s.set(zmq::sockopt::linger, 0);
+                s.connect(addr);
+            }
+            msgs.push_back(zmq::message_t(relay_token));
+            s.send(zmq::message_t(0), zmq::send_flags::sndmore);
+            send_multipart(s, msgs);
+        } catch (zmq::error_t const &e) { // eg. name does not resolve
+            if (s.handle() == nullptr)
+                upstream_socks.erase(addr);
+            fetch_fallback(upstream.find(hash));
+        }
+    }
+    void io_from_upstream(zmq::socket_t &s) {
+        std::vector<zmq::message_t> msgs;
+        recv_multipart(s, std::back_inserter(msgs));
+        if (msgs.size() < 4 || msgs[0].size() != 0)
+            return;
+        msgs.erase(msgs.begin());
+        auto it = upstream.find(msg2hash(msgs[1]));
+        if (it == upstream.end() || it->second.addr.empty() || it->second.first != msg2int(msgs[2]))
+            return; // we already asked the master instead
+        if (msgs.size() == 3) {
+            fetch_fallback(it);
+            return;
+        }
+        upstream.erase(it);
+        relay_add(msgs);
+        send_multipart(io_peer, msgs);
+    }
+    // ask the master for fragments a peer did not send in time or did not have
+    std::unordered_map<uint64_t, upstream_t>::iterator fetch_fallback(
+            std::unordered_map<uint64_t, upstream_t>::iterator it) {
+        if (it->second.addr.empty())
+            return ++it; // already waiting for the master
+        failed_upstream.insert(it->second.addr);
+        it->second.addr.clear();
+        it->second.sent = Time::now();
+        sock.send(zmq::message_t(0), zmq::send_flags::sndmore);
+        sock.send(int2msg(wlife_t::fetch), zmq::send_flags::sndmore);
+        sock.send(hash2msg(it->first), zmq::send_flags::sndmore);
+        sock.send(int2msg(it->second.first), zmq::send_flags::sndmore);
+        sock.send(int2msg(it->second.n), zmq::send_flags::none);
+        io_last_sent = Time::now();
+        return ++it;
+    }
+
+    // objects are kept by content hash as long as any name is bound to them
+    void bind_obj(const std::string &name, const uint64_t hash) {
+        auto &c = cache[hash];
+        c.refs++;
+        auto it = env_hash.find(name);
+        if (it != env_hash.end()) {
+            auto &prev = cache[it->second];
+            if (--prev.refs == 0) {
+                cache.erase(it->second);
+                io.send(int2msg(wlife_t::relay), zmq::send_flags::sndmore); // stop relaying
+                io.send(zmq::message_t(std::string("drop")), zmq::send_flags::sndmore);
+                io.send(hash2msg(it->second), zmq::send_flags::none);
+            }
+            it->second = hash;
+        } else
+            env_hash[name] = hash;
+
+        if (name.compare(0, 8, "package:") == 0)
+            load_pkg(name.substr(8, std::string::npos));
+        else if (c.lazy != R_NilValue && !Rcpp::XPtr<lazy_obj_t>(c.lazy)->done) {
+            Rcpp::Function lazy_obj = Rcpp::Environment::namespace_env("clustermq")["lazy_obj"];
+            Rcpp::RObject get = Rf_lang2(lazy_obj, c.lazy);
+            delayed_assign(name, get, R_BaseEnv, env);
+        } else if (c.lazy != R_NilValue)
+            env.assign(name, Rcpp::XPtr<lazy_obj_t>(c.lazy)->get());
+        else
+            env.assign(name, c.obj);
+    }
+
+    // atomic results of a columnar chunk are sent in a typed frame instead
+    // of with the result list, if they are named by its call IDs in order
+    static zmq::message_t typed_result(SEXP eval, SEXP chunk) {
+        SEXP ids = VECTOR_ELT(chunk, Rf_xlength(chunk) - 1);
+        R_xlen_t len = Rf_xlength(ids);
+        if (TYPEOF(eval) != VECSXP || Rf_xlength(eval) != 3 || len == 0)
+            return zmq::message_t();
+        SEXP res = VECTOR_ELT(eval, 0);
+        SEXP names = Rf_getAttrib(res, R_NamesSymbol);
+        if (!Rf_isVectorAtomic(res) || Rf_xlength(res) != len || names == R_NilValue)
+            return zmq::message_t();
+        for (R_xlen_t i=0; i<len; i++) {
+            char *end;
+            const char *name = CHAR(STRING_ELT(names, i));
+            if (std::strtol(name, &end, 10) != INTEGER(ids)[i] || *end != '\0')
+                return zmq::message_t();
+        }
+        auto msg = typed_result_encode(res, INTEGER(ids)[0] - 1);
+        if (msg.size() != 0)
+            SET_VECTOR_ELT(eval, 0, R_NilValue);
+        return msg;
+    }
+
+    void set_config(Rcpp::List config) {
+        compress = Rcpp::as<int>(config["compress"]);
+        delta = Rcpp::as<int>(config["delta"]);
+        lazy = Rcpp::as<int>(config["lazy"]);
+        send_stats = Rcpp::as<bool>(config["stats"]);
+        send_trace = Rcpp::as<bool>(config["trace"]);
+        int hb = Rcpp::as<int>(config["heartbeat"]);
+        if (hb != heartbeat) {
+            heartbeat = hb;
+            io.send(int2msg(wlife_t::heartbeat), zmq::send_flags::none); // wakes I/O thread
+        }
+        if (Rcpp::as<int>(config["broadcast"]) > 0 && !relay_bound) {
+            Rcpp::CharacterVector info = Rcpp::Function("Sys.info")();
+            auto relay_cfg = Rcpp::as<Rcpp::List>(config["relay"]);
+            auto ports = Rcpp::as<Rcpp::IntegerVector>(relay_cfg["ports"]);
+            io.send(int2msg(wlife_t::relay), zmq::send_flags::sndmore);
+            io.send(zmq::message_t(std::string("bind")), zmq::send_flags::sndmore);
+            io.send(zmq::message_t(Rcpp::as<std::string>(info["nodename"])), zmq::send_flags::sndmore);
+            io.send(zmq::message_t(Rcpp::as<std::string>(relay_cfg["token"])), zmq::send_flags::sndmore);
+            io.send(int2msg(Rcpp::as<int>(relay_cfg["timeout"])), zmq::send_flags::sndmore);
+            io.send(zmq::message_t(ports.begin(), ports.size() * sizeof(int)), zmq::send_flags::none);
+            relay_bound = true;
+        }
+    }
+
+    zmq::message_t apply_delta(const std::string &name, const zmq::message_t &msg) {
+        auto it = cache.find(delta_base(msg));
+        if (it == cache.end() || it->second.base.size() == 0)
+            Rcpp::stop("Delta base not found in worker cache: " + name);
+        auto target = delta_apply(it->second.base, msg);
+        if (target.size() == 0)
+            Rcpp::stop("Applying delta failed: " + name);
+        return target;
+    }
+
+    // fetch fragments while unserializing: the next request is sent as soon as
+    // the previous reply arrived, so at most two replies are held at a time
+    void fetch_obj(const uint64_t hash, const zmq::message_t &header) {
+        uint64_t size, frag_size;
+        fragment_info(header, size, frag_size);
+        const std::string source = fragment_source(header); // relaying worker
+        const int n_frags = frag_size == 0 ? 0 : (size + frag_size - 1) / frag_size;
+        int requested = 0;
+        bool pending = false;
+        std::vector<zmq::message_t> reply;
+        size_t next = 0;
+        uint64_t received = 0;
+        char *kept = nullptr;
+        size_t kept_size = 0;
+
+        auto request = [&]() {
+            int n = std::min(fetch_credits, n_frags - requested);
+            io.send(int2msg(wlife_t::fetch), zmq::send_flags::sndmore);
+            io.send(hash2msg(hash), zmq::send_flags::sndmore);
+            io.send(int2msg(requested), zmq::send_flags::sndmore);
+            if (source.empty()) {
+                io.send(int2msg(n), zmq::send_flags::none);
+            } else {
+                io.send(int2msg(n), zmq::send_flags::sndmore);
+                io.send(zmq::message_t(source), zmq::send_flags::none);
+            }
+            requested += n;
+            pending = true;
+        };
+        auto refill = [&](const char *&data, size_t &n) {
+            if (next == reply.size()) {
+                if (!pending)
+                    return false;
+                try {
+                    reply = recv_call();
+                    while (msg2wlife_t(reply[0]) != wlife_t::fetch) {
+                        backlog.push_back(std::move(reply));
+                        reply = recv_call();
+                    }
+                    pending = false;
+                    if (requested < n_frags)
+                        request();
+                } catch (...) { // no exceptions through R_Unserialize
+                    return false;
+                }
+                next = 3; // status, hash, index
+                if (reply.size() <= next || msg2hash(reply[1]) != hash)
+                    return false;
+            }
+            auto &frag = reply[next++];
+            data = static_cast<const char*>(frag.data());
+            n = frag.size();
+            if (received == 0 && delta >= 0 && (is_compressed(frag) ? uncompressed_size(frag) : size) >=
+                    static_cast<size_t>(delta))
+                kept = static_cast<char*>(malloc(kept_size = size));
+            if (kept != nullptr && received + n <= kept_size)
+                memcpy(kept + received, data, n);
+            received += n;
+            return true;
+        };
+
+        request();
+        msg_reader_t reader(nullptr, 0, refill);
+        auto &c = cache[hash];
+        try {
+            c.obj = reader2r(reader);
+        } catch (...) {
+            free(kept);
+            throw;
+        }
+        if (pending || received != size) {
+            free(kept);
+            Rcpp::stop("Incomplete fragmented object received");
+        }
+        if (kept != nullptr)
+            c.base = zmq::message_t(kept, size, [](void *data, void *hint) { free(data); });
+    }
 
     void check_send_ready(int timeout=5000) {
         auto pitems = std::vector<zmq::pollitem_t>(1);
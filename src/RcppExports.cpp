@@ -10,6 +10,17 @@ Rcpp::Rostream<true>&  Rcpp::Rcout = Rcpp::Rcpp_cout_get();
 Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
+// lazy_obj
+SEXP lazy_obj(SEXP ptr);
+RcppExport SEXP _clustermq_lazy_obj(SEXP ptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ptr(ptrSEXP);
+    rcpp_result_gen = Rcpp::wrap(lazy_obj(ptr));
+    return rcpp_result_gen;
+END_RCPP
+}
 // has_connectivity
 bool has_connectivity(std::string host);
 RcppExport SEXP _clustermq_has_connectivity(SEXP hostSEXP) {
@@ -42,15 +53,32 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// time_msg_roundtrip
+Rcpp::NumericVector time_msg_roundtrip(SEXP obj, int reps, int compress);
+RcppExport SEXP _clustermq_time_msg_roundtrip(SEXP objSEXP, SEXP repsSEXP, SEXP compressSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type obj(objSEXP);
+    Rcpp::traits::input_parameter< int >::type reps(repsSEXP);
+    Rcpp::traits::input_parameter< int >::type compress(compressSEXP);
+    rcpp_result_gen = Rcpp::wrap(time_msg_roundtrip(obj, reps, compress));
+    return rcpp_result_gen;
+END_RCPP
+}
 
+RcppExport SEXP _rcpp_module_boot_cmq_loadgen();
 RcppExport SEXP _rcpp_module_boot_cmq_master();
 RcppExport SEXP _rcpp_module_boot_cmq_proxy();
 RcppExport SEXP _rcpp_module_boot_cmq_worker();
 
 static const R_CallMethodDef CallEntries[] = {
+    {"_clustermq_lazy_obj", (DL_FUNC) &_clustermq_lazy_obj, 1},
     {"_clustermq_has_connectivity", (DL_FUNC) &_clustermq_has_connectivity, 1},
     {"_clustermq_libzmq_has_draft", (DL_FUNC) &_clustermq_libzmq_has_draft, 0},
     {"_clustermq_alloc_non_r_bytes", (DL_FUNC) &_clustermq_alloc_non_r_bytes, 1},
+    {"_clustermq_time_msg_roundtrip", (DL_FUNC) &_clustermq_time_msg_roundtrip, 3},
+    {"_rcpp_module_boot_cmq_loadgen", (DL_FUNC) &_rcpp_module_boot_cmq_loadgen, 0},
     {"_rcpp_module_boot_cmq_master", (DL_FUNC) &_rcpp_module_boot_cmq_master, 0},
     {"_rcpp_module_boot_cmq_proxy", (DL_FUNC) &_rcpp_module_boot_cmq_proxy, 0},
     {"_rcpp_module_boot_cmq_worker", (DL_FUNC) &_rcpp_module_boot_cmq_worker, 0},
@@ -0,0 +1,349 @@
+#include <climits>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include "columnar.h"
+
+// Column types, each followed by its values for the rows of the chunk
+namespace {
+
+const char col_lgl = 'l';
+const char col_int = 'i';
+const char col_real = 'r';
+const char col_raw = 'x';
+const char col_str = 's'; // dictionary, then indices
+const char col_factor = 'f'; // ordered flag, levels, then codes
+const uint32_t na_index = 0xffffffffU;
+
+template<typename T> void put(std::vector<char> &out, const T val) {
+    const char *p = reinterpret_cast<const char*>(&val);
+    out.insert(out.end(), p, p + sizeof(val));
+}
+
+void put_bytes(std::vector<char> &out, const void *data, const size_t n) {
+    const char *p = static_cast<const char*>(data);
+    out.insert(out.end(), p, p + n);
+}
+
+struct reader_t {
+    const char *ip;
+    const char *iend;
+
+    template<typename T> bool get(T &val) {
+        if (static_cast<size_t>(iend - ip) < sizeof(val))
+            return false;
+        memcpy(&val, ip, sizeof(val));
+        ip += sizeof(val);
+        return true;
+    }
+    const char *take(const size_t n) {
+        if (static_cast<size_t>(iend - ip) < n)
+            return nullptr;
+        ip += n;
+        return ip - n;
+    }
+};
+
+// R caches CHARSXPs, so equal strings in the same encoding share a pointer
+void put_strings(std::vector<char> &out, SEXP x, const R_xlen_t start, const R_xlen_t len) {
+    std::unordered_map<SEXP, uint32_t> dict;
+    std::vector<SEXP> entries;
+    std::vector<uint32_t> idx(len);
+    for (R_xlen_t i=0; i<len; i++) {
+        SEXP s = STRING_ELT(x, start + i);
+        if (s == NA_STRING) {
+            idx[i] = na_index;
+            continue;
+        }
+        auto it = dict.emplace(s, entries.size());
+        if (it.second)
+            entries.push_back(s);
+        idx[i] = it.first->second;
+    }
+
+    put(out, static_cast<uint32_t>(entries.size()));
+    for (auto s : entries) {
+        put(out, static_cast<uint8_t>(Rf_getCharCE(s)));
+        put(out, static_cast<uint32_t>(LENGTH(s)));
+        put_bytes(out, CHAR(s), LENGTH(s));
+    }
+    put_bytes(out, idx.data(), idx.size() * sizeof(uint32_t));
+}
+
+SEXP get_strings(reader_t &r, const R_xlen_t len) {
+    const size_t min_entry = sizeof(uint8_t) + sizeof(uint32_t);
+    uint32_t n;
+    if (!r.get(n) || n > static_cast<size_t>(r.iend - r.ip) / min_entry)
+        return R_NilValue;
+    Rcpp::RObject dict = Rf_allocVector(STRSXP, n);
+    for (uint32_t i=0; i<n; i++) {
+        uint8_t ce;
+        uint32_t size;
+        const char *s;
+        if (!r.get(ce) || !r.get(size) || (s = r.take(size)) == nullptr)
+            return R_NilValue;
+        SET_STRING_ELT(dict, i, Rf_mkCharLenCE(s, size, static_cast<cetype_t>(ce)));
+    }
+
+    const char *idx = r.take(len * sizeof(uint32_t));
+    if (idx == nullptr)
+        return R_NilValue;
+    Rcpp::RObject res = Rf_allocVector(STRSXP, len);
+    for (R_xlen_t i=0; i<len; i++) {
+        uint32_t k;
+        memcpy(&k, idx + i * sizeof(k), sizeof(k));
+        if (k == na_index)
+            SET_STRING_ELT(res, i, NA_STRING);
+        else if (k < n)
+            SET_STRING_ELT(res, i, STRING_ELT(dict, k));
+        else
+            return R_NilValue;
+    }
+    return res;
+}
+
+SEXP get_values(reader_t &r, const SEXPTYPE type, const R_xlen_t len, const size_t size) {
+    const char *data = r.take(len * size);
+    if (data == nullptr)
+        return R_NilValue;
+    SEXP res = Rf_allocVector(type, len);
+    switch(type) {
+        case LGLSXP: memcpy(LOGICAL(res), data, len * size); break;
+        case INTSXP: memcpy(INTEGER(res), data, len * size); break;
+        case REALSXP: memcpy(REAL(res), data, len * size); break;
+        case RAWSXP: memcpy(RAW(res), data, len * size); break;
+    }
+    return res;
+}
+
+// plain vectors and factors; anything else is serialized with the call
+bool encodable(SEXP x) {
+    if (Rf_getAttrib(x, R_NamesSymbol) != R_NilValue)
+        return false;
+    if (OBJECT(x)) {
+        if (TYPEOF(x) != INTSXP || !Rf_inherits(x, "factor"))
+            return false;
+        return Rf_xlength(Rf_getAttrib(x, R_ClassSymbol)) == (Rf_inherits(x, "ordered") ? 2 : 1);
+    }
+    switch(TYPEOF(x)) {
+        case LGLSXP:
+        case INTSXP:
+        case REALSXP:
+        case RAWSXP:
+        case STRSXP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// the values of a plain vector, with its type; false if it can not be encoded
+bool put_column(std::vector<char> &out, SEXP x, const R_xlen_t start, const R_xlen_t len) {
+    switch(TYPEOF(x)) {
+        case LGLSXP:
+            out.push_back(col_lgl);
+            put_bytes(out, LOGICAL(x) + start, len * sizeof(int));
+            break;
+        case INTSXP:
+            if (OBJECT(x)) {
+                SEXP levels = Rf_getAttrib(x, R_LevelsSymbol);
+                out.push_back(col_factor);
+                put(out, static_cast<uint8_t>(Rf_inherits(x, "ordered")));
+                put(out, static_cast<uint32_t>(Rf_xlength(levels)));
+                put_strings(out, levels, 0, Rf_xlength(levels));
+            } else
+                out.push_back(col_int);
+            put_bytes(out, INTEGER(x) + start, len * sizeof(int));
+            break;
+        case REALSXP:
+            out.push_back(col_real);
+            put_bytes(out, REAL(x) + start, len * sizeof(double));
+            break;
+        case RAWSXP:
+            out.push_back(col_raw);
+            put_bytes(out, RAW(x) + start, len);
+            break;
+        case STRSXP:
+            out.push_back(col_str);
+            put_strings(out, x, start, len);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+SEXP get_column(reader_t &r, const R_xlen_t len) {
+    char type;
+    if (!r.get(type))
+        return R_NilValue;
+    switch(type) {
+        case col_lgl: return get_values(r, LGLSXP, len, sizeof(int));
+        case col_int: return get_values(r, INTSXP, len, sizeof(int));
+        case col_real: return get_values(r, REALSXP, len, sizeof(double));
+        case col_raw: return get_values(r, RAWSXP, len, 1);
+        case col_str: return get_strings(r, len);
+        case col_factor: {
+            uint8_t ordered;
+            uint32_t n_levels;
+            if (!r.get(ordered) || !r.get(n_levels))
+                return R_NilValue;
+            Rcpp::RObject levels = get_strings(r, n_levels);
+            if (levels == R_NilValue)
+                return R_NilValue;
+            Rcpp::RObject col = get_values(r, INTSXP, len, sizeof(int));
+            if (col == R_NilValue)
+                return R_NilValue;
+            Rcpp::RObject cls = Rf_allocVector(STRSXP, ordered ? 2 : 1);
+            if (ordered)
+                SET_STRING_ELT(cls, 0, Rf_mkChar("ordered"));
+            SET_STRING_ELT(cls, ordered ? 1 : 0, Rf_mkChar("factor"));
+            Rf_setAttrib(col, R_LevelsSymbol, levels);
+            Rf_setAttrib(col, R_ClassSymbol, cls);
+            return col;
+        }
+        default:
+            return R_NilValue;
+    }
+}
+
+zmq::message_t vec2msg(std::vector<char> *v) {
+    return zmq::message_t(v->data(), v->size(), [](void *data, void *hint) {
+            delete static_cast<std::vector<char>*>(hint); }, v);
+}
+
+} // namespace
+
+bool is_columnar(const zmq::message_t &msg) {
+    return msg.size() >= columnar_header_size &&
+        memcmp(msg.data(), columnar_magic, sizeof(columnar_magic)) == 0;
+}
+
+// rows [start, start+len) of each column in 'iter', or an empty frame if a
+// column can not be encoded
+zmq::message_t columnar_encode(SEXP iter, const R_xlen_t start, const R_xlen_t len) {
+    SEXP names = Rf_getAttrib(iter, R_NamesSymbol);
+    R_xlen_t n_cols = Rf_xlength(iter);
+    if (names == R_NilValue || start + len > INT_MAX)
+        return zmq::message_t();
+    for (R_xlen_t i=0; i<n_cols; i++) {
+        if (!encodable(VECTOR_ELT(iter, i)))
+            return zmq::message_t();
+    }
+
+    auto out = new std::vector<char>(columnar_magic, columnar_magic + sizeof(columnar_magic));
+    put(*out, static_cast<uint32_t>(n_cols));
+    put(*out, static_cast<uint64_t>(start));
+    put(*out, static_cast<uint64_t>(len));
+    for (R_xlen_t i=0; i<n_cols; i++) {
+        SEXP x = VECTOR_ELT(iter, i);
+        const char *name = Rf_translateCharUTF8(STRING_ELT(names, i));
+        put(*out, static_cast<uint32_t>(strlen(name)));
+        put_bytes(*out, name, strlen(name));
+        put_column(*out, x, start, len);
+    }
+    return vec2msg(out);
+}
+
+// the same list as CMQMaster::map_chunk, or NULL if the frame is malformed
+SEXP columnar_decode(const zmq::message_t &msg) {
+    if (!is_columnar(msg))
+        return R_NilValue;
+    auto data = static_cast<const char*>(msg.data());
+    reader_t r{data + sizeof(columnar_magic), data + msg.size()};
+    uint32_t n_cols;
+    uint64_t start, len;
+    if (!r.get(n_cols) || !r.get(start) || !r.get(len) || start + len > INT_MAX)
+        return R_NilValue;
+
+    Rcpp::List chunk(n_cols + 1);
+    Rcpp::RObject names = Rf_allocVector(STRSXP, n_cols + 1);
+    for (uint32_t i=0; i<n_cols; i++) {
+        uint32_t name_size;
+        const char *name;
+        if (!r.get(name_size) || (name = r.take(name_size)) == nullptr)
+            return R_NilValue;
+        SET_STRING_ELT(names, i, Rf_mkCharLenCE(name, name_size, CE_UTF8));
+
+        Rcpp::RObject col = get_column(r, len);
+        if (col == R_NilValue)
+            return R_NilValue;
+        chunk[i] = col;
+    }
+    if (r.ip != r.iend)
+        return R_NilValue;
+
+    Rcpp::IntegerVector ids(len);
+    for (R_xlen_t i=0; i<static_cast<R_xlen_t>(len); i++)
+        ids[i] = start + i + 1;
+    chunk[n_cols] = ids;
+    SET_STRING_ELT(names, n_cols, Rf_mkChar(" id "));
+    chunk.names() = names;
+    return chunk;
+}
+
+bool is_typed_result(const zmq::message_t &msg) {
+    return msg.size() >= typed_header_size &&
+        memcmp(msg.data(), typed_magic, sizeof(typed_magic)) == 0;
+}
+
+// unnamed plain vector 'x' with the results of calls start+1, ..., or an
+// empty frame if it can not be encoded
+zmq::message_t typed_result_encode(SEXP x, const R_xlen_t start) {
+    if (OBJECT(x) || TYPEOF(x) == RAWSXP)
+        return zmq::message_t();
+    auto out = new std::vector<char>(typed_magic, typed_magic + sizeof(typed_magic));
+    put(*out, static_cast<uint64_t>(start));
+    put(*out, static_cast<uint64_t>(Rf_xlength(x)));
+    if (!put_column(*out, x, 0, Rf_xlength(x))) {
+        delete out;
+        return zmq::message_t();
+    }
+    return vec2msg(out);
+}
+
+// the unnamed result vector, or NULL if the frame is malformed
+SEXP typed_result_decode(const zmq::message_t &msg, R_xlen_t &start) {
+    if (!is_typed_result(msg))
+        return R_NilValue;
+    auto data = static_cast<const char*>(msg.data());
+    reader_t r{data + sizeof(typed_magic), data + msg.size()};
+    uint64_t first, len;
+    if (!r.get(first) || !r.get(len))
+        return R_NilValue;
+    Rcpp::RObject res = get_column(r, len);
+    if (res == R_NilValue || r.ip != r.iend)
+        return R_NilValue;
+    start = first;
+    return res;
+}
+
+// copies numeric or logical results straight to their place in 'dest' if it
+// has the same type; false otherwise or if the frame is malformed
+bool typed_result_copy(const zmq::message_t &msg, SEXP dest) {
+    if (!is_typed_result(msg))
+        return false;
+    auto data = static_cast<const char*>(msg.data());
+    reader_t r{data + sizeof(typed_magic), data + msg.size()};
+    uint64_t first, len;
+    char type;
+    if (!r.get(first) || !r.get(len) || !r.get(type))
+        return false;
+    if (first > static_cast<uint64_t>(Rf_xlength(dest)) ||
+            len > static_cast<uint64_t>(Rf_xlength(dest)) - first)
+        return false;
+
+    size_t size = type == col_real ? sizeof(double) : sizeof(int);
+    const char *values = r.take(len * size);
+    if (values == nullptr || r.ip != r.iend)
+        return false;
+    if (type == col_lgl && TYPEOF(dest) == LGLSXP)
+        memcpy(LOGICAL(dest) + first, values, len * size);
+    else if (type == col_int && TYPEOF(dest) == INTSXP)
+        memcpy(INTEGER(dest) + first, values, len * size);
+    else if (type == col_real && TYPEOF(dest) == REALSXP)
+        memcpy(REAL(dest) + first, values, len * size);
+    else
+        return false;
+    return true;
+}
@@ -0,0 +1,31 @@
+#ifndef _COLUMNAR_H_
+#define _COLUMNAR_H_
+
+#include <Rcpp.h>
+#include <cstddef>
+#include <cstdint>
+#include "zmq.hpp"
+
+// Chunks of iterated arguments can be sent as a columnar frame instead of
+// being serialized with the call: a magic, the number of columns and the
+// range of call IDs, followed by each column's name, type and contiguous
+// values (strings as a dictionary and indices into it)
+const char columnar_magic[] = {'C', 'M', 'Q', 'c'};
+const size_t columnar_header_size = sizeof(columnar_magic) + sizeof(uint32_t) +
+    2 * sizeof(uint64_t);
+
+// Atomic results of a columnar chunk are returned in the same encoding as a
+// single column, preceded by a magic and the range of call IDs
+const char typed_magic[] = {'C', 'M', 'Q', 'r'};
+const size_t typed_header_size = sizeof(typed_magic) + 2 * sizeof(uint64_t) + 1;
+
+bool is_columnar(const zmq::message_t &msg);
+zmq::message_t columnar_encode(SEXP iter, const R_xlen_t start, const R_xlen_t len);
+SEXP columnar_decode(const zmq::message_t &msg);
+
+bool is_typed_result(const zmq::message_t &msg);
+zmq::message_t typed_result_encode(SEXP x, const R_xlen_t start);
+SEXP typed_result_decode(const zmq::message_t &msg, R_xlen_t &start);
+bool typed_result_copy(const zmq::message_t &msg, SEXP dest);
+
+#endif // _COLUMNAR_H_
@@ -1,8 +1,5 @@
 #include "common.h"
 
-Rcpp::Function R_serialize("serialize");
-Rcpp::Function R_unserialize("unserialize");
-
 const char* wlife_t2str(wlife_t status) {
     switch(status) {
         case wlife_t::active: return "active";
@@ -11,6 +8,10 @@ const char* wlife_t2str(wlife_t status) {
         case wlife_t::error: return "error";
         case wlife_t::proxy_cmd: return "proxy_cmd";
         case wlife_t::proxy_error: return "proxy_error";
+        case wlife_t::fetch: return "fetch";
+        case wlife_t::heartbeat: return "heartbeat";
+        case wlife_t::lost: return "lost";
+        case wlife_t::relay: return "relay";
         default: Rcpp::stop("Invalid worker status");
     }
 }
@@ -29,21 +30,212 @@ zmq::message_t int2msg(const int val) {
     return msg;
 }
 
-zmq::message_t r2msg(SEXP data) {
-    if (TYPEOF(data) != RAWSXP)
-        data = R_serialize(data, R_NilValue);
-    zmq::message_t msg(Rf_xlength(data));
-    memcpy(msg.data(), RAW(data), Rf_xlength(data));
+int msg2int(const zmq::message_t &msg) {
+    int val = 0;
+    if (msg.size() == sizeof(int))
+        memcpy(&val, msg.data(), sizeof(int));
+    return val;
+}
+
+// R_Serialize writes into a malloc'd buffer that is handed to zmq without copy
+struct ser_buf_t {
+    ~ser_buf_t() { free(data); }
+    char *data {nullptr};
+    size_t size {0};
+    size_t cap {0};
+};
+
+static void ser_out_bytes(R_outpstream_t stream, void *buf, int n) {
+    auto b = static_cast<ser_buf_t*>(stream->data);
+    if (b->size + n > b->cap) {
+        size_t cap = std::max(2 * b->cap, b->size + n);
+        auto data = static_cast<char*>(realloc(b->data, cap));
+        if (data == nullptr)
+            Rf_error("Could not allocate %.0f bytes for serialization", static_cast<double>(cap));
+        b->data = data;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->size, buf, n);
+    b->size += n;
+}
+static void ser_out_char(R_outpstream_t stream, int c) {
+    char ch = static_cast<char>(c);
+    ser_out_bytes(stream, &ch, 1);
+}
+static SEXP ser_unwind(void *data) {
+    auto args = static_cast<std::pair<SEXP, R_outpstream_t>*>(data);
+    R_Serialize(args->first, args->second);
+    return R_NilValue;
+}
+
+// R_Unserialize reads directly from the zmq frame (no RAWSXP intermediate),
+// decompressing blocks on the fly if the frame was compressed
+static void unser_in_bytes(R_inpstream_t stream, void *buf, int n) {
+    auto reader = static_cast<msg_reader_t*>(stream->data);
+    if (!reader->read(buf, n))
+        Rf_error("Unserialize read past end of message or corrupt data");
+}
+static int unser_in_char(R_inpstream_t stream) {
+    unsigned char ch;
+    unser_in_bytes(stream, &ch, 1);
+    return ch;
+}
+static SEXP unser_unwind(void *data) {
+    return R_Unserialize(static_cast<R_inpstream_t>(data));
+}
+
+zmq::message_t r2msg(SEXP data, const int compress) {
+    ser_buf_t buf;
+    buf.cap = 1024;
+    buf.data = static_cast<char*>(malloc(buf.cap));
+    if (buf.data == nullptr)
+        Rcpp::stop("Could not allocate serialization buffer");
+
+    R_outpstream_st stream;
+    R_InitOutPStream(&stream, &buf, R_pstream_xdr_format, 3, ser_out_char,
+            ser_out_bytes, NULL, R_NilValue);
+    auto args = std::make_pair(data, &stream);
+    Rcpp::unwindProtect(ser_unwind, &args);
+
+    zmq::message_t msg(buf.data, buf.size, [](void *data, void *hint) { free(data); });
+    buf.data = nullptr;
+    if (compress >= 0 && msg.size() >= static_cast<size_t>(compress))
+        return compress_msg(std::move(msg));
     return msg;
 }
 
 SEXP msg2r(const zmq::message_t &&msg, const bool unserialize) {
-    SEXP ans = Rf_allocVector(RAWSXP, msg.size());
-    memcpy(RAW(ans), msg.data(), msg.size());
-    if (unserialize)
-        return R_unserialize(ans);
-    else
+    if (!unserialize) {
+        SEXP ans = Rf_allocVector(RAWSXP, msg.size());
+        memcpy(RAW(ans), msg.data(), msg.size());
         return ans;
+    }
+
+    msg_reader_t reader(msg.data(), msg.size());
+    return reader2r(reader);
+}
+
+SEXP reader2r(msg_reader_t &reader) {
+    R_inpstream_st stream;
+    R_InitInPStream(&stream, &reader, R_pstream_any_format, unser_in_char,
+            unser_in_bytes, NULL, R_NilValue);
+    return Rcpp::unwindProtect(unser_unwind, &stream);
+}
+
+zmq::message_t hash2msg(const uint64_t hash) {
+    zmq::message_t msg(sizeof(uint64_t));
+    memcpy(msg.data(), &hash, sizeof(uint64_t));
+    return msg;
+}
+
+uint64_t msg2hash(const zmq::message_t &msg) {
+    uint64_t hash = 0;
+    if (msg.size() == sizeof(uint64_t))
+        memcpy(&hash, msg.data(), sizeof(uint64_t));
+    return hash;
+}
+
+zmq::message_t hashes2msg(const std::vector<uint64_t> &hashes) {
+    zmq::message_t msg(hashes.size() * sizeof(uint64_t));
+    if (!hashes.empty())
+        memcpy(msg.data(), hashes.data(), msg.size());
+    return msg;
+}
+
+std::vector<uint64_t> msg2hashes(const zmq::message_t &msg) {
+    std::vector<uint64_t> hashes(msg.size() / sizeof(uint64_t));
+    if (!hashes.empty())
+        memcpy(hashes.data(), msg.data(), hashes.size() * sizeof(uint64_t));
+    return hashes;
+}
+
+zmq::message_t fragment_header(const uint64_t size, const uint64_t frag_size,
+        const std::string &source) {
+    zmq::message_t msg(frag_header_size + source.size());
+    auto p = static_cast<char*>(msg.data());
+    memcpy(p, frag_magic, sizeof(frag_magic));
+    memcpy(p + sizeof(frag_magic), &size, sizeof(size));
+    memcpy(p + sizeof(frag_magic) + sizeof(size), &frag_size, sizeof(frag_size));
+    memcpy(p + frag_header_size, source.data(), source.size());
+    return msg;
+}
+
+bool is_fragmented(const zmq::message_t &msg) {
+    return msg.size() >= frag_header_size &&
+        memcmp(msg.data(), frag_magic, sizeof(frag_magic)) == 0;
+}
+
+void fragment_info(const zmq::message_t &msg, uint64_t &size, uint64_t &frag_size) {
+    auto p = static_cast<const char*>(msg.data()) + sizeof(frag_magic);
+    memcpy(&size, p, sizeof(size));
+    memcpy(&frag_size, p + sizeof(size), sizeof(frag_size));
+}
+
+std::string fragment_source(const zmq::message_t &msg) {
+    auto p = static_cast<const char*>(msg.data());
+    return std::string(p + frag_header_size, msg.size() - frag_header_size);
+}
+
+// xxHash64 (seed 0) to identify serialized objects by their content
+namespace {
+const uint64_t P1 = 11400714785074694791ULL;
+const uint64_t P2 = 14029467366897019727ULL;
+const uint64_t P3 = 1609587929392839161ULL;
+const uint64_t P4 = 9650029242287828579ULL;
+const uint64_t P5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+inline uint64_t read64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+inline uint64_t round64(uint64_t acc, uint64_t input) {
+    return rotl(acc + input * P2, 31) * P1;
+}
+inline uint64_t merge64(uint64_t acc, uint64_t val) {
+    return (acc ^ round64(0, val)) * P1 + P4;
+}
+} // namespace
+
+uint64_t hash64(const void *data, size_t n) {
+    const char *p = static_cast<const char*>(data);
+    const char *end = p + n;
+    uint64_t h;
+
+    if (n >= 32) {
+        uint64_t v1 = P1 + P2, v2 = P2, v3 = 0, v4 = 0 - P1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge64(merge64(merge64(merge64(h, v1), v2), v3), v4);
+    } else
+        h = P5;
+
+    h += n;
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ round64(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        h = rotl(h ^ (v * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = rotl(h ^ (static_cast<unsigned char>(*p) * P5), 11) * P1;
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
 }
 
 wlife_t msg2wlife_t(const zmq::message_t &msg) {
@@ -52,15 +244,17 @@ wlife_t msg2wlife_t(const zmq::message_t &msg) {
     return res;
 }
 
+// index of the empty frame that ends the routing ids of a message, or the
+// number of frames if there is none (no R API, proxies call this in a thread)
+size_t find_delimiter(const std::vector<zmq::message_t> &msgs) {
+    size_t i = 0;
+    while (i < msgs.size() && msgs[i].size() != 0)
+        i++;
+    return i;
+}
+
 std::string z85_encode_routing_id(const std::string rid) {
     std::string dest(5, 0);
     zmq_z85_encode(&dest[0], reinterpret_cast<const uint8_t*>(&rid[1]), 4);
     return dest;
 }
-
-std::set<std::string> set_difference(std::set<std::string> &set1, std::set<std::string> &set2) {
-    std::set<std::string> diff;
-    std::set_difference(set1.begin(), set1.end(), set2.begin(), set2.end(),
-            std::inserter(diff, diff.end()));
-    return diff;
-}
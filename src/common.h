@@ -3,11 +3,18 @@
 
 #include <Rcpp.h>
 #include <chrono>
+#include <deque>
+#include <map>
+#include <set>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 #include "zmq.hpp"
 #include "zmq_addon.hpp"
+#include "columnar.h"
+#include "compress.h"
+#include "delta.h"
 
 #if ! ZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 0) || \
     ! CPPZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 10, 0)
@@ -26,21 +33,42 @@ enum wlife_t {
     finished,
     error,
     proxy_cmd,
-    proxy_error
+    proxy_error,
+    fetch,
+    heartbeat,
+    lost,
+    relay
 };
 const char* wlife_t2str(wlife_t status);
+
+// Objects larger than the fragment size are sent as a header with the total
+// and fragment size, and the worker fetches the fragments separately; the
+// header may end with the address of another worker to fetch them from
+const char frag_magic[] = {'C', 'M', 'Q', 'f'};
+const size_t frag_header_size = sizeof(frag_magic) + 2 * sizeof(uint64_t);
+
 typedef std::chrono::high_resolution_clock Time;
 typedef std::chrono::milliseconds ms;
-extern Rcpp::Function R_serialize;
-extern Rcpp::Function R_unserialize;
 
 void check_interrupt_fn(void *dummy);
 int pending_interrupt();
 zmq::message_t int2msg(const int val);
-zmq::message_t r2msg(SEXP data);
+int msg2int(const zmq::message_t &msg);
+zmq::message_t r2msg(SEXP data, const int compress=-1);
 SEXP msg2r(const zmq::message_t &&msg, const bool unserialize);
+SEXP reader2r(msg_reader_t &reader);
+zmq::message_t hash2msg(const uint64_t hash);
+uint64_t msg2hash(const zmq::message_t &msg);
+zmq::message_t hashes2msg(const std::vector<uint64_t> &hashes);
+std::vector<uint64_t> msg2hashes(const zmq::message_t &msg);
+uint64_t hash64(const void *data, size_t n);
+zmq::message_t fragment_header(const uint64_t size, const uint64_t frag_size,
+        const std::string &source="");
+bool is_fragmented(const zmq::message_t &msg);
+void fragment_info(const zmq::message_t &msg, uint64_t &size, uint64_t &frag_size);
+std::string fragment_source(const zmq::message_t &msg);
 wlife_t msg2wlife_t(const zmq::message_t &msg);
+size_t find_delimiter(const std::vector<zmq::message_t> &msgs);
 std::string z85_encode_routing_id(const std::string rid);
-std::set<std::string> set_difference(std::set<std::string> &set1, std::set<std::string> &set2);
 
 #endif // _COMMON_H_
@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "compress.h"
+
+// LZ77-type block codec in the spirit of LZ4: a token byte holds the literal
+// and match lengths (extended by 255-runs), followed by the literals, and a
+// 16 bit offset into the previous 64 kb of output for the match
+namespace {
+
+const int hash_bits = 14;
+const size_t min_match = 4;
+const size_t max_offset = 65535;
+const size_t end_literals = 8; // matches never extend into the last bytes
+
+inline uint32_t read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761U) >> (32 - hash_bits);
+}
+
+inline char *write_len(char *op, size_t len) {
+    while (len >= 255) {
+        *op++ = static_cast<char>(255);
+        len -= 255;
+    }
+    *op++ = static_cast<char>(len);
+    return op;
+}
+
+inline bool read_len(const char *&ip, const char *iend, size_t &len) {
+    unsigned char b;
+    do {
+        if (ip >= iend)
+            return false;
+        b = static_cast<unsigned char>(*ip++);
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+char *write_sequence(char *op, const char *lit, size_t n_lit, size_t offset, size_t n_match) {
+    char *token = op++;
+    unsigned char t = n_lit >= 15 ? 15 << 4 : n_lit << 4;
+    if (n_lit >= 15)
+        op = write_len(op, n_lit - 15);
+    memcpy(op, lit, n_lit);
+    op += n_lit;
+
+    if (n_match > 0) {
+        *op++ = static_cast<char>(offset & 0xff);
+        *op++ = static_cast<char>(offset >> 8);
+        size_t ml = n_match - min_match;
+        t |= ml >= 15 ? 15 : ml;
+        if (ml >= 15)
+            op = write_len(op, ml - 15);
+    }
+    *token = static_cast<char>(t);
+    return op;
+}
+
+} // namespace
+
+size_t lz_compress_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+size_t lz_compress(const char *src, size_t n, char *dst) {
+    std::vector<uint32_t> table(1 << hash_bits, 0);
+    const char *ip = src;
+    const char *anchor = src;
+    const char *iend = src + n;
+    char *op = dst;
+
+    if (n > end_literals + min_match) {
+        const char *mlimit = iend - end_literals;
+        while (ip + min_match <= mlimit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash32(seq);
+            const char *ref = src + table[h];
+            table[h] = static_cast<uint32_t>(ip - src);
+
+            if (ref >= ip || static_cast<size_t>(ip - ref) > max_offset || read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+
+            const char *mp = ip + min_match;
+            const char *rp = ref + min_match;
+            while (mp < mlimit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+            op = write_sequence(op, anchor, ip - anchor, ip - ref, mp - ip);
+            ip = anchor = mp;
+        }
+    }
+
+    return write_sequence(op, anchor, iend - anchor, 0, 0) - dst;
+}
+
+bool lz_decompress(const char *src, size_t n, char *dst, size_t n_dst) {
+    const char *ip = src;
+    const char *iend = src + n;
+    char *op = dst;
+    char *oend = dst + n_dst;
+
+    while (ip < iend) {
+        unsigned char t = static_cast<unsigned char>(*ip++);
+        size_t n_lit = t >> 4;
+        if (n_lit == 15 && !read_len(ip, iend, n_lit))
+            return false;
+        if (n_lit > static_cast<size_t>(iend - ip) || n_lit > static_cast<size_t>(oend - op))
+            return false;
+        memcpy(op, ip, n_lit);
+        ip += n_lit;
+        op += n_lit;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        size_t offset = static_cast<unsigned char>(ip[0]) |
+            (static_cast<size_t>(static_cast<unsigned char>(ip[1])) << 8);
+        ip += 2;
+        size_t n_match = t & 15;
+        if (n_match == 15 && !read_len(ip, iend, n_match))
+            return false;
+        n_match += min_match;
+        if (offset == 0 || offset > static_cast<size_t>(op - dst) ||
+                n_match > static_cast<size_t>(oend - op))
+            return false;
+        const char *ref = op - offset;
+        for (size_t i=0; i<n_match; i++) // may overlap
+            *op++ = *ref++;
+    }
+    return op == oend;
+}
+
+bool is_compressed(const zmq::message_t &msg) {
+    return msg.size() >= lz_header_size &&
+        memcmp(msg.data(), lz_magic, sizeof(lz_magic)) == 0;
+}
+
+size_t uncompressed_size(const zmq::message_t &msg) {
+    if (!is_compressed(msg))
+        return msg.size();
+    uint64_t size;
+    memcpy(&size, static_cast<const char*>(msg.data()) + sizeof(lz_magic), sizeof(size));
+    return size;
+}
+
+// block header: compressed size, or the raw size with the high bit set for
+// blocks that did not compress and are stored as-is
+zmq::message_t compress_msg(zmq::message_t &&msg) {
+    const char *src = static_cast<const char*>(msg.data());
+    const uint64_t n = msg.size();
+    const size_t n_blocks = (n + lz_block_size - 1) / lz_block_size;
+    const size_t bound = lz_header_size + n_blocks * (sizeof(uint32_t) +
+            lz_compress_bound(lz_block_size));
+    auto dst = static_cast<char*>(malloc(bound));
+    if (dst == nullptr)
+        return std::move(msg);
+
+    memcpy(dst, lz_magic, sizeof(lz_magic));
+    memcpy(dst + sizeof(lz_magic), &n, sizeof(n));
+    char *op = dst + lz_header_size;
+    for (size_t pos=0; pos<n; pos+=lz_block_size) {
+        size_t raw = std::min(lz_block_size, static_cast<size_t>(n - pos));
+        size_t comp = lz_compress(src + pos, raw, op + sizeof(uint32_t));
+        uint32_t hdr = static_cast<uint32_t>(comp);
+        if (comp >= raw) {
+            memcpy(op + sizeof(uint32_t), src + pos, raw);
+            comp = raw;
+            hdr = static_cast<uint32_t>(raw) | 0x80000000U;
+        }
+        memcpy(op, &hdr, sizeof(hdr));
+        op += sizeof(uint32_t) + comp;
+    }
+
+    size_t size = op - dst;
+    if (size >= n) {
+        free(dst);
+        return std::move(msg);
+    }
+    return zmq::message_t(dst, size, [](void *data, void *hint) { free(data); });
+}
+
+// frames that are not compressed or fail to decode are returned as they are
+zmq::message_t decompress_msg(zmq::message_t &&msg) {
+    if (!is_compressed(msg))
+        return std::move(msg);
+    size_t n = uncompressed_size(msg);
+    auto dst = static_cast<char*>(malloc(n > 0 ? n : 1));
+    if (dst == nullptr)
+        return std::move(msg);
+
+    msg_reader_t reader(msg.data(), msg.size());
+    if (!reader.read(dst, n) || !reader.at_end()) {
+        free(dst);
+        return std::move(msg);
+    }
+    return zmq::message_t(dst, n, [](void *data, void *hint) { free(data); });
+}
+
+msg_reader_t::msg_reader_t(const void *data, size_t size, refill_t refill):
+        src(static_cast<const char*>(data)), src_size(size), refill(refill) {
+    if (src_size == 0)
+        next_fragment();
+    if (src_size >= lz_header_size && memcmp(src, lz_magic, sizeof(lz_magic)) == 0) {
+        uint64_t n;
+        memcpy(&n, src + sizeof(lz_magic), sizeof(n));
+        compressed = true;
+        remaining = n;
+        src_pos = lz_header_size;
+        block.reserve(lz_block_size);
+    }
+}
+
+bool msg_reader_t::read(void *buf, size_t n) {
+    auto out = static_cast<char*>(buf);
+    if (!compressed)
+        return fill(out, n);
+
+    while (n > 0) {
+        if (block_pos == block.size() && !next_block())
+            return false;
+        size_t k = std::min(n, block.size() - block_pos);
+        memcpy(out, block.data() + block_pos, k);
+        block_pos += k;
+        out += k;
+        n -= k;
+    }
+    return true;
+}
+
+bool msg_reader_t::at_end() const {
+    if (compressed)
+        return remaining == 0 && block_pos == block.size();
+    return src_pos == src_size;
+}
+
+bool msg_reader_t::fill(char *out, size_t n) {
+    while (n > 0) {
+        if (src_pos == src_size && !next_fragment())
+            return false;
+        size_t k = std::min(n, src_size - src_pos);
+        memcpy(out, src + src_pos, k);
+        src_pos += k;
+        out += k;
+        n -= k;
+    }
+    return true;
+}
+
+// contiguous input bytes, copied only if they straddle a fragment boundary
+const char *msg_reader_t::view(size_t n) {
+    if (src_size - src_pos >= n) {
+        src_pos += n;
+        return src + src_pos - n;
+    }
+    straddle.resize(n);
+    return fill(straddle.data(), n) ? straddle.data() : nullptr;
+}
+
+bool msg_reader_t::next_fragment() {
+    if (!refill)
+        return false;
+    const char *data;
+    size_t size;
+    if (!refill(data, size))
+        return false;
+    src = data;
+    src_size = size;
+    src_pos = 0;
+    return true;
+}
+
+bool msg_reader_t::next_block() {
+    uint32_t hdr;
+    if (remaining == 0 || !fill(reinterpret_cast<char*>(&hdr), sizeof(hdr)))
+        return false;
+
+    size_t raw = std::min(lz_block_size, remaining);
+    size_t comp = hdr & 0x7fffffffU;
+    if (comp > lz_compress_bound(lz_block_size))
+        return false;
+    const char *data = view(comp);
+    if (data == nullptr)
+        return false;
+    block.resize(raw);
+    if (hdr & 0x80000000U) {
+        if (comp != raw)
+            return false;
+        memcpy(block.data(), data, raw);
+    } else if (!lz_decompress(data, comp, block.data(), raw))
+        return false;
+
+    remaining -= raw;
+    block_pos = 0;
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "zmq.hpp"
+
+// Compressed frames start with a magic and the uncompressed size, followed by
+// independently compressed blocks so they can be decoded while streaming
+const char lz_magic[] = {'C', 'M', 'Q', 'z'};
+const size_t lz_header_size = sizeof(lz_magic) + sizeof(uint64_t);
+const size_t lz_block_size = 1 << 20;
+
+size_t lz_compress_bound(size_t n);
+size_t lz_compress(const char *src, size_t n, char *dst);
+bool lz_decompress(const char *src, size_t n, char *dst, size_t n_dst);
+
+bool is_compressed(const zmq::message_t &msg);
+size_t uncompressed_size(const zmq::message_t &msg);
+zmq::message_t compress_msg(zmq::message_t &&msg);
+zmq::message_t decompress_msg(zmq::message_t &&msg);
+
+// sequential reader over a frame that decompresses blocks as they are needed;
+// if a refill function is given, the frame continues in the fragments it
+// supplies (each valid until the next call)
+class msg_reader_t {
+public:
+    typedef std::function<bool(const char *&data, size_t &size)> refill_t;
+
+    msg_reader_t(const void *data, size_t size, refill_t refill=nullptr);
+    bool read(void *buf, size_t n);
+    bool at_end() const;
+
+private:
+    const char *src;
+    size_t src_size;
+    size_t src_pos {0};
+    refill_t refill;
+    bool compressed {false};
+    size_t remaining {0};
+    std::vector<char> block;
+    std::vector<char> straddle;
+    size_t block_pos {0};
+
+    bool fill(char *out, size_t n);
+    const char *view(size_t n);
+    bool next_fragment();
+    bool next_block();
+};
+
+#endif // _COMPRESS_H_
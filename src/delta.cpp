@@ -0,0 +1,241 @@
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include "compress.h"
+#include "delta.h"
+
+// rsync-style block matching: the base is indexed by a weak rolling checksum
+// of its aligned blocks, and the target is scanned byte by byte for blocks
+// that can be copied from the base; everything else is sent as data
+namespace {
+
+const size_t block_size = 1024;
+const char op_copy = 'c';
+const char op_data = 'd';
+
+struct checksum_t {
+    uint32_t a {0};
+    uint32_t b {0};
+
+    void init(const unsigned char *p, size_t n) {
+        a = b = 0;
+        for (size_t i=0; i<n; i++) {
+            a += p[i];
+            b += (n - i) * p[i];
+        }
+    }
+    void roll(unsigned char out, unsigned char in, size_t n) {
+        a += in - out;
+        b += a - n * out;
+    }
+    uint32_t digest() const {
+        return (a & 0xffff) | (b << 16);
+    }
+};
+
+// returns a pointer to the uncompressed content, decompressing if required
+const char *raw_content(const zmq::message_t &msg, std::vector<char> &buf) {
+    if (!is_compressed(msg))
+        return static_cast<const char*>(msg.data());
+    buf.resize(uncompressed_size(msg));
+    msg_reader_t reader(msg.data(), msg.size());
+    if (!reader.read(buf.data(), buf.size()))
+        return nullptr;
+    return buf.data();
+}
+
+void put64(std::vector<char> &out, uint64_t val) {
+    const char *p = reinterpret_cast<const char*>(&val);
+    out.insert(out.end(), p, p + sizeof(val));
+}
+
+bool get64(const char *&ip, const char *iend, uint64_t &val) {
+    if (static_cast<size_t>(iend - ip) < sizeof(val))
+        return false;
+    memcpy(&val, ip, sizeof(val));
+    ip += sizeof(val);
+    return true;
+}
+
+zmq::message_t vec2msg(std::vector<char> *v) {
+    return zmq::message_t(v->data(), v->size(), [](void *data, void *hint) {
+            delete static_cast<std::vector<char>*>(hint); }, v);
+}
+
+} // namespace
+
+bool is_delta(const zmq::message_t &msg) {
+    return msg.size() >= delta_header_size &&
+        memcmp(msg.data(), delta_magic, sizeof(delta_magic)) == 0;
+}
+
+uint64_t delta_base(const zmq::message_t &msg) {
+    uint64_t hash;
+    memcpy(&hash, static_cast<const char*>(msg.data()) + sizeof(delta_magic), sizeof(hash));
+    return hash;
+}
+
+uint64_t delta_target_size(const zmq::message_t &msg) {
+    uint64_t size;
+    memcpy(&size, static_cast<const char*>(msg.data()) + sizeof(delta_magic) +
+            sizeof(uint64_t), sizeof(size));
+    return size;
+}
+
+zmq::message_t delta_encode(const zmq::message_t &base, const uint64_t base_hash,
+        const zmq::message_t &target) {
+    std::vector<char> base_buf;
+    auto b = reinterpret_cast<const unsigned char*>(raw_content(base, base_buf));
+    auto t = static_cast<const unsigned char*>(target.data());
+    size_t n_b = base_buf.empty() ? base.size() : base_buf.size();
+    size_t n_t = target.size();
+    if (b == nullptr || n_b < block_size || n_t < block_size)
+        return zmq::message_t();
+
+    // chained index of base blocks by weak checksum
+    size_t n_blocks = n_b / block_size;
+    std::unordered_map<uint32_t, size_t> first;
+    std::vector<size_t> next(n_blocks, n_blocks);
+    first.reserve(n_blocks);
+    checksum_t cs;
+    for (size_t i=n_blocks; i-- > 0;) {
+        cs.init(b + i * block_size, block_size);
+        auto it = first.find(cs.digest());
+        if (it != first.end()) {
+            next[i] = it->second;
+            it->second = i;
+        } else
+            first[cs.digest()] = i;
+    }
+
+    auto out = new std::vector<char>(delta_magic, delta_magic + sizeof(delta_magic));
+    put64(*out, base_hash);
+    put64(*out, n_t);
+    const size_t max_size = n_t / 2;
+
+    size_t pos = 0, lit = 0;
+    cs.init(t, block_size);
+    while (pos + block_size <= n_t && out->size() + pos - lit < max_size) {
+        size_t match = n_blocks;
+        auto it = first.find(cs.digest());
+        if (it != first.end()) {
+            for (size_t i=it->second; i<n_blocks; i=next[i]) {
+                if (memcmp(b + i * block_size, t + pos, block_size) == 0) {
+                    match = i;
+                    break;
+                }
+            }
+        }
+
+        if (match == n_blocks) {
+            if (pos + block_size < n_t)
+                cs.roll(t[pos], t[pos + block_size], block_size);
+            pos++;
+            continue;
+        }
+
+        size_t b_off = match * block_size;
+        size_t len = block_size;
+        while (b_off + len + block_size <= n_b && pos + len + block_size <= n_t &&
+                memcmp(b + b_off + len, t + pos + len, block_size) == 0)
+            len += block_size;
+        while (b_off + len < n_b && pos + len < n_t && b[b_off + len] == t[pos + len])
+            len++;
+        while (b_off > 0 && pos > lit && b[b_off - 1] == t[pos - 1]) {
+            b_off--;
+            pos--;
+            len++;
+        }
+
+        if (pos > lit) {
+            out->push_back(op_data);
+            put64(*out, pos - lit);
+            out->insert(out->end(), t + lit, t + pos);
+        }
+        out->push_back(op_copy);
+        put64(*out, b_off);
+        put64(*out, len);
+        pos = lit = pos + len;
+        if (pos + block_size <= n_t)
+            cs.init(t + pos, block_size);
+    }
+
+    if (out->size() + n_t - lit >= max_size) {
+        delete out;
+        return zmq::message_t();
+    }
+    if (lit < n_t) {
+        out->push_back(op_data);
+        put64(*out, n_t - lit);
+        out->insert(out->end(), t + lit, t + n_t);
+    }
+    return vec2msg(out);
+}
+
+// compresses the operations if that makes the frame smaller
+zmq::message_t delta_compress(zmq::message_t &&delta) {
+    if (delta.size() <= delta_header_size)
+        return std::move(delta);
+    auto data = static_cast<const char*>(delta.data());
+    auto ops = compress_msg(zmq::message_t(data + delta_header_size, delta.size() - delta_header_size));
+    if (!is_compressed(ops))
+        return std::move(delta);
+    zmq::message_t msg(delta_header_size + ops.size());
+    memcpy(msg.data(), data, delta_header_size);
+    memcpy(static_cast<char*>(msg.data()) + delta_header_size, ops.data(), ops.size());
+    return msg;
+}
+
+zmq::message_t delta_apply(const zmq::message_t &base, const zmq::message_t &delta) {
+    std::vector<char> base_buf;
+    const char *b = raw_content(base, base_buf);
+    size_t n_b = base_buf.empty() ? base.size() : base_buf.size();
+    size_t n_t = delta_target_size(delta);
+    if (b == nullptr)
+        return zmq::message_t();
+
+    // operations start with their type, so a compressed block has the magic
+    const char *ip = static_cast<const char*>(delta.data()) + delta_header_size;
+    const char *iend = static_cast<const char*>(delta.data()) + delta.size();
+    std::vector<char> ops_buf;
+    if (static_cast<size_t>(iend - ip) >= lz_header_size &&
+            memcmp(ip, lz_magic, sizeof(lz_magic)) == 0) {
+        uint64_t n_ops;
+        memcpy(&n_ops, ip + sizeof(lz_magic), sizeof(n_ops));
+        ops_buf.resize(n_ops);
+        msg_reader_t reader(ip, iend - ip);
+        if (!reader.read(ops_buf.data(), n_ops) || !reader.at_end())
+            return zmq::message_t();
+        ip = ops_buf.data();
+        iend = ip + n_ops;
+    }
+
+    auto out = new std::vector<char>(n_t);
+    char *op = out->data();
+    char *oend = op + n_t;
+    uint64_t off, len;
+    while (ip < iend) {
+        char type = *ip++;
+        if (type == op_copy) {
+            if (!get64(ip, iend, off) || !get64(ip, iend, len) || off > n_b ||
+                    len > n_b - off || len > static_cast<size_t>(oend - op))
+                break;
+            memcpy(op, b + off, len);
+        } else if (type == op_data) {
+            if (!get64(ip, iend, len) || len > static_cast<size_t>(iend - ip) ||
+                    len > static_cast<size_t>(oend - op))
+                break;
+            memcpy(op, ip, len);
+            ip += len;
+        } else
+            break;
+        op += len;
+    }
+
+    if (ip != iend || op != oend) {
+        delete out;
+        return zmq::message_t();
+    }
+    return vec2msg(out);
+}
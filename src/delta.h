@@ -0,0 +1,22 @@
+#ifndef _DELTA_H_
+#define _DELTA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include "zmq.hpp"
+
+// Delta frames start with a magic, the content hash of the base object and
+// the size of the target, followed by copy (from base) and data operations;
+// the operations may be compressed as a whole, so the header stays readable
+const char delta_magic[] = {'C', 'M', 'Q', 'd'};
+const size_t delta_header_size = sizeof(delta_magic) + 2 * sizeof(uint64_t);
+
+bool is_delta(const zmq::message_t &msg);
+uint64_t delta_base(const zmq::message_t &msg);
+uint64_t delta_target_size(const zmq::message_t &msg);
+zmq::message_t delta_encode(const zmq::message_t &base, const uint64_t base_hash,
+        const zmq::message_t &target);
+zmq::message_t delta_compress(zmq::message_t &&delta);
+zmq::message_t delta_apply(const zmq::message_t &base, const zmq::message_t &delta);
+
+#endif // _DELTA_H_
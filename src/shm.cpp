@@ -0,0 +1,103 @@
+#include <cstdio>
+#include <cstring>
+#include "shm.h"
+
+bool is_shm(const zmq::message_t &msg) {
+    return msg.size() > shm_header_size &&
+        memcmp(msg.data(), shm_magic, sizeof(shm_magic)) == 0;
+}
+
+zmq::message_t shm_header(const std::string &name, const uint64_t size) {
+    zmq::message_t msg(shm_header_size + name.size());
+    auto data = static_cast<char*>(msg.data());
+    memcpy(data, shm_magic, sizeof(shm_magic));
+    memcpy(data + sizeof(shm_magic), &size, sizeof(size));
+    memcpy(data + shm_header_size, name.data(), name.size());
+    return msg;
+}
+
+#ifdef _WIN32
+
+// shared memory is not used, objects are sent as frames instead
+zmq::message_t shm_create(const uint64_t hash, zmq::message_t &&msg, std::string &name) {
+    name.clear();
+    return std::move(msg);
+}
+
+zmq::message_t shm_map(const zmq::message_t &header) {
+    return zmq::message_t();
+}
+
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+struct segment_t {
+    std::string name;
+    size_t size;
+};
+
+} // namespace
+
+// Copies the frame to a new segment and returns a read-only mapping of it that
+// removes the segment when it is freed, or the frame itself (and an empty
+// name) if that fails. Names are limited to 31 characters on macOS. On Linux,
+// the space is allocated up front: tmpfs segments are sparse after ftruncate,
+// and writing beyond a full /dev/shm would raise SIGBUS instead of an error
+zmq::message_t shm_create(const uint64_t hash, zmq::message_t &&msg, std::string &name) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "/cmq%d-%016llx", static_cast<int>(getpid()),
+            static_cast<unsigned long long>(hash));
+    name.clear();
+    size_t size = msg.size();
+    int fd = shm_open(buf, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+        return std::move(msg);
+    void *data = MAP_FAILED;
+#ifdef __linux__
+    bool allocated = size > 0 && posix_fallocate(fd, 0, size) == 0;
+#else
+    bool allocated = size > 0 && ftruncate(fd, size) == 0;
+#endif
+    if (allocated)
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        shm_unlink(buf);
+        return std::move(msg);
+    }
+    memcpy(data, msg.data(), size);
+    mprotect(data, size, PROT_READ);
+
+    name = buf;
+    auto seg = new segment_t{name, size};
+    return zmq::message_t(data, size, [](void *data, void *hint) {
+        auto seg = static_cast<segment_t*>(hint);
+        munmap(data, seg->size);
+        shm_unlink(seg->name.c_str());
+        delete seg;
+    }, seg);
+}
+
+// read-only view of the segment in the header, or an empty frame on failure
+zmq::message_t shm_map(const zmq::message_t &header) {
+    auto hdr = static_cast<const char*>(header.data());
+    uint64_t size;
+    memcpy(&size, hdr + sizeof(shm_magic), sizeof(size));
+    std::string name(hdr + shm_header_size, header.size() - shm_header_size);
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return zmq::message_t();
+    void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return zmq::message_t();
+    return zmq::message_t(data, size, [](void *data, void *hint) {
+        munmap(data, reinterpret_cast<size_t>(hint)); }, reinterpret_cast<void*>(size));
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "zmq.hpp"
+
+// Objects for workers on the same host can be placed in a POSIX shared memory
+// segment by the master, and the frame sent instead holds a magic, the object
+// size and the segment name that workers map read-only
+const char shm_magic[] = {'C', 'M', 'Q', 's'};
+const size_t shm_header_size = sizeof(shm_magic) + sizeof(uint64_t);
+
+bool is_shm(const zmq::message_t &msg);
+zmq::message_t shm_header(const std::string &name, const uint64_t size);
+zmq::message_t shm_create(const uint64_t hash, zmq::message_t &&msg, std::string &name);
+zmq::message_t shm_map(const zmq::message_t &header);
+
+#endif // _SHM_H_
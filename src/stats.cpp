@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "stats.h"
+
+const std::vector<std::string> master_stages {"serialize", "send", "wait",
+    "unserialize", "roundtrip"};
+const std::vector<std::string> worker_stages {"wait", "unserialize", "eval",
+    "serialize", "reply"};
+const std::vector<std::string> loadgen_stages {"connect", "turnaround"};
+
+namespace {
+
+template<typename T> void put(std::string &out, const T val) {
+    out.append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+template<typename T> bool get(const char *&ip, const char *iend, T &val) {
+    if (static_cast<size_t>(iend - ip) < sizeof(val))
+        return false;
+    memcpy(&val, ip, sizeof(val));
+    ip += sizeof(val);
+    return true;
+}
+
+// upper bound of each bucket in seconds
+double bucket_le(const int i) {
+    return std::ldexp(1e-6, i);
+}
+
+} // namespace
+
+void hist_t::add(const double secs) {
+    int e = 0;
+    double us = secs * 1e6;
+    if (us > 1)
+        std::frexp(us, &e);
+    counts[std::min(e, hist_buckets - 1)]++;
+    n++;
+    sum += secs;
+    max = std::max(max, secs);
+}
+
+void hist_t::merge(const hist_t &other) {
+    for (int i=0; i<hist_buckets; i++)
+        counts[i] += other.counts[i];
+    n += other.n;
+    sum += other.sum;
+    max = std::max(max, other.max);
+}
+
+// upper bound of the bucket that holds the quantile, but at most the maximum
+double hist_t::quantile(const double q) const {
+    if (n == 0)
+        return NA_REAL;
+    uint64_t rank = static_cast<uint64_t>(std::ceil(q * n));
+    uint64_t seen = 0;
+    for (int i=0; i<hist_buckets-1; i++) {
+        seen += counts[i];
+        if (seen >= rank)
+            return std::min(bucket_le(i), max);
+    }
+    return max;
+}
+
+void stats_t::merge(const stats_t &other) {
+    for (size_t i=0; i<hists.size() && i<other.hists.size(); i++)
+        hists[i].merge(other.hists[i]);
+}
+
+zmq::message_t stats_t::encode(const uint64_t sent, const uint64_t recv) const {
+    std::string out(stats_magic, sizeof(stats_magic));
+    put(out, sent);
+    put(out, recv);
+    put(out, static_cast<uint32_t>(hists.size()));
+    for (const auto &h : hists) {
+        put(out, h.n);
+        put(out, h.sum);
+        put(out, h.max);
+        uint8_t first = 0, last = 0;
+        for (int i=0; i<hist_buckets; i++) {
+            if (h.counts[i] == 0)
+                continue;
+            if (last == 0)
+                first = i;
+            last = i + 1;
+        }
+        put(out, first);
+        put(out, static_cast<uint8_t>(last - first));
+        for (int i=first; i<last; i++)
+            put(out, h.counts[i]);
+    }
+    return zmq::message_t(out);
+}
+
+// replaces the histograms if the frame is valid, which may carry fewer
+// stages than we know
+bool stats_t::decode(const zmq::message_t &msg, uint64_t &sent, uint64_t &recv) {
+    if (!is_stats(msg))
+        return false;
+    const char *ip = static_cast<const char*>(msg.data()) + sizeof(stats_magic);
+    const char *iend = static_cast<const char*>(msg.data()) + msg.size();
+    uint32_t n_stages;
+    if (!get(ip, iend, sent) || !get(ip, iend, recv) || !get(ip, iend, n_stages))
+        return false;
+    std::vector<hist_t> res(hists.size());
+    for (uint32_t s=0; s<n_stages; s++) {
+        hist_t h;
+        uint8_t first, n;
+        if (!get(ip, iend, h.n) || !get(ip, iend, h.sum) || !get(ip, iend, h.max) ||
+                !get(ip, iend, first) || !get(ip, iend, n) || first + n > hist_buckets)
+            return false;
+        for (int i=first; i<first+n; i++) {
+            if (!get(ip, iend, h.counts[i]))
+                return false;
+        }
+        if (s < res.size())
+            res[s] = h;
+    }
+    if (ip != iend)
+        return false;
+    hists = std::move(res);
+    return true;
+}
+
+// stage summaries, and the bucket counts with their upper bounds as column
+// names for exporting the histograms
+Rcpp::List stats_t::to_r() const {
+    size_t n = hists.size();
+    Rcpp::NumericVector count(n), total(n), mean(n), p50(n), p90(n), p99(n), max(n);
+    Rcpp::NumericMatrix buckets(n, hist_buckets);
+    for (size_t i=0; i<n; i++) {
+        const auto &h = hists[i];
+        count[i] = h.n;
+        total[i] = h.sum;
+        mean[i] = h.n > 0 ? h.sum / h.n : NA_REAL;
+        p50[i] = h.quantile(0.5);
+        p90[i] = h.quantile(0.9);
+        p99[i] = h.quantile(0.99);
+        max[i] = h.n > 0 ? h.max : NA_REAL;
+        for (int j=0; j<hist_buckets; j++)
+            buckets(i, j) = h.counts[j];
+    }
+    Rcpp::CharacterVector le(hist_buckets);
+    for (int j=0; j<hist_buckets-1; j++)
+        le[j] = std::to_string(bucket_le(j));
+    le[hist_buckets-1] = "+Inf";
+    Rcpp::rownames(buckets) = Rcpp::wrap(stages);
+    Rcpp::colnames(buckets) = le;
+    return Rcpp::List::create(
+        Rcpp::_["stages"] = Rcpp::DataFrame::create(
+            Rcpp::_["stage"] = Rcpp::wrap(stages),
+            Rcpp::_["count"] = count,
+            Rcpp::_["total"] = total,
+            Rcpp::_["mean"] = mean,
+            Rcpp::_["p50"] = p50,
+            Rcpp::_["p90"] = p90,
+            Rcpp::_["p99"] = p99,
+            Rcpp::_["max"] = max,
+            Rcpp::_["stringsAsFactors"] = false),
+        Rcpp::_["buckets"] = buckets
+    );
+}
+
+bool is_stats(const zmq::message_t &msg) {
+    return msg.size() >= sizeof(stats_magic) &&
+        memcmp(msg.data(), stats_magic, sizeof(stats_magic)) == 0;
+}
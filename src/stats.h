@@ -0,0 +1,63 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <Rcpp.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "zmq.hpp"
+
+// Latency histograms with power-of-two buckets from 1 us to about 18 minutes
+// (the last bucket is open), so recording a time is a clock read and an
+// increment. Workers send theirs to the master in a frame with a magic, the
+// bytes sent and received, and the count, sum, max and non-zero buckets of
+// each stage
+const int hist_buckets = 32;
+const char stats_magic[] = {'C', 'M', 'Q', 't'};
+
+// the master waits for results, and times calls from sending to their result;
+// workers wait for calls, and hand results to their I/O thread in 'reply'
+enum master_stage_t { ms_serialize, ms_send, ms_wait, ms_unserialize, ms_roundtrip };
+enum worker_stage_t { ws_wait, ws_unserialize, ws_eval, ws_serialize, ws_reply };
+// synthetic workers time their first call after connecting, and the time
+// from sending a result to receiving the next call
+enum loadgen_stage_t { ls_connect, ls_turnaround };
+extern const std::vector<std::string> master_stages;
+extern const std::vector<std::string> worker_stages;
+extern const std::vector<std::string> loadgen_stages;
+
+struct hist_t {
+    uint64_t counts[hist_buckets] {};
+    uint64_t n {0};
+    double sum {0}; // seconds
+    double max {0};
+
+    void add(const double secs);
+    void merge(const hist_t &other);
+    double quantile(const double q) const;
+};
+
+class stats_t {
+public:
+    typedef std::chrono::high_resolution_clock::time_point time_point;
+
+    explicit stats_t(const std::vector<std::string> &stages):
+        stages(stages), hists(stages.size()) {}
+
+    void add(const size_t stage, const time_point start) {
+        hists[stage].add(std::chrono::duration<double>(
+                    std::chrono::high_resolution_clock::now() - start).count());
+    }
+    void merge(const stats_t &other);
+    zmq::message_t encode(const uint64_t sent, const uint64_t recv) const;
+    bool decode(const zmq::message_t &msg, uint64_t &sent, uint64_t &recv);
+    Rcpp::List to_r() const;
+
+    std::vector<std::string> stages;
+    std::vector<hist_t> hists;
+};
+
+bool is_stats(const zmq::message_t &msg);
+
+#endif // _STATS_H_
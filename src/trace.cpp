@@ -0,0 +1,63 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "trace.h"
+
+int64_t trace_now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+zmq::message_t time2msg(const int64_t time) {
+    return zmq::message_t(&time, sizeof(time));
+}
+
+int64_t msg2time(const zmq::message_t &msg) {
+    int64_t time = 0;
+    if (msg.size() == sizeof(time))
+        memcpy(&time, msg.data(), sizeof(time));
+    return time;
+}
+
+bool is_trace(const zmq::message_t &msg) {
+    return msg.size() == trace_frame_size &&
+        memcmp(msg.data(), trace_magic, sizeof(trace_magic)) == 0;
+}
+
+zmq::message_t trace_encode(const call_times_t &times) {
+    zmq::message_t msg(trace_frame_size);
+    char *p = static_cast<char*>(msg.data());
+    memcpy(p, trace_magic, sizeof(trace_magic));
+    p += sizeof(trace_magic);
+    for (auto t : {times.received, times.eval_start, times.eval_end}) {
+        memcpy(p, &t, sizeof(t));
+        p += sizeof(t);
+    }
+    return msg;
+}
+
+call_times_t trace_decode(const zmq::message_t &msg) {
+    call_times_t times;
+    const char *p = static_cast<const char*>(msg.data()) + sizeof(trace_magic);
+    memcpy(&times.received, p, sizeof(int64_t));
+    memcpy(&times.eval_start, p + sizeof(int64_t), sizeof(int64_t));
+    memcpy(&times.eval_end, p + 2 * sizeof(int64_t), sizeof(int64_t));
+    return times;
+}
+
+// quoted and escaped JSON string
+std::string json_str(const std::string &s) {
+    std::string out("\"");
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else
+            out += c;
+    }
+    return out + "\"";
+}
@@ -0,0 +1,29 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <cstdint>
+#include <string>
+#include "zmq.hpp"
+
+// With tracing enabled, workers append a frame to each result with a magic
+// and the wall clock times (us since the epoch) the call was received by
+// their I/O thread, and its evaluation started and ended. The master turns
+// these and its own times into trace-event JSON (as read by Perfetto)
+const char trace_magic[] = {'C', 'M', 'Q', 'e'};
+const size_t trace_frame_size = sizeof(trace_magic) + 3 * sizeof(int64_t);
+
+struct call_times_t {
+    int64_t received;
+    int64_t eval_start;
+    int64_t eval_end;
+};
+
+int64_t trace_now();
+zmq::message_t time2msg(const int64_t time);
+int64_t msg2time(const zmq::message_t &msg);
+bool is_trace(const zmq::message_t &msg);
+zmq::message_t trace_encode(const call_times_t &times);
+call_times_t trace_decode(const zmq::message_t &msg);
+std::string json_str(const std::string &s);
+
+#endif // _TRACE_H_
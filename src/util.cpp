@@ -1,6 +1,7 @@
 #include <Rcpp.h>
 #include <string>
 #include "zmq.hpp"
+#include "common.h"
 
 // [[Rcpp::export]]
 bool has_connectivity(std::string host) {
@@ -59,3 +60,21 @@ Rcpp::XPtr<std::vector<unsigned char>> alloc_non_r_bytes(long n_bytes) {
     Rcpp::XPtr<std::vector<unsigned char>> p(buf, true);
     return p;
 }
+
+// total seconds to serialize an object to a frame and back 'reps' times, and
+// the frame size (for bench/messages.r)
+// [[Rcpp::export]]
+Rcpp::NumericVector time_msg_roundtrip(SEXP obj, int reps, int compress) {
+    double serialize = 0, unserialize = 0, bytes = 0;
+    for (int i=0; i<reps; i++) {
+        auto start = Time::now();
+        auto msg = r2msg(obj, compress);
+        auto mid = Time::now();
+        bytes = msg.size();
+        msg2r(std::move(msg), true);
+        serialize += std::chrono::duration<double>(mid - start).count();
+        unserialize += std::chrono::duration<double>(Time::now() - mid).count();
+    }
+    return Rcpp::NumericVector::create(Rcpp::_["bytes"] = bytes,
+            Rcpp::_["serialize"] = serialize, Rcpp::_["unserialize"] = unserialize);
+}
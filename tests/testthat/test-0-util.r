@@ -28,6 +28,15 @@ test_that("template required key", {
     expect_error(fill_template(tmpl, values, required="missing"))
 })
 
+test_that("template without role fails for node workers", {
+    tmpl = "clustermq:::worker('{{ master }}')"
+    values = list(master="tcp://localhost:1234", role="proxy")
+
+    expect_error(fill_template(tmpl, values), "role")
+    expect_equal(fill_template(tmpl, values["master"]),
+                 "clustermq:::worker('tcp://localhost:1234')")
+})
+
 test_that("template filling works with vectors", {
     tmpl = "{{ var1 }} and {{ var2 }}"
     values = c(var1=1, var2=2)
@@ -40,6 +40,94 @@ test_that("worker evaluation", {
     m$close(500L)
 })
 
+test_that("multiple calls are queued at the worker", {
+    m = methods::new(CMQMaster)
+    w = methods::new(CMQWorker, m$context())
+    addr = m$listen("inproc://endpoint")
+    m$add_pending_workers(1L)
+    w$connect(addr, 500L)
+
+    m$recv(500L)
+    r1 = m$send_eval(expression(1))
+    r2 = m$send_eval(expression(2))
+    expect_true(w$process_one())
+    expect_true(w$process_one())
+    expect_equal(m$recv(500L), 1)
+    expect_equal(m$current()$call_ref, r1)
+    expect_equal(m$recv(500L), 2)
+    expect_equal(m$current()$call_ref, r2)
+
+    w$close()
+    m$close(500L)
+})
+
+test_that("queued results are sent when the worker closes", {
+    m = methods::new(CMQMaster)
+    w = methods::new(CMQWorker, m$context())
+    addr = m$listen("inproc://endpoint")
+    m$add_pending_workers(1L)
+    w$connect(addr, 500L)
+
+    m$recv(500L)
+    m$send_eval(expression(5 * 3))
+    m$send_eval(expression(5 * 4))
+    expect_true(w$process_one())
+    expect_true(w$process_one())
+    w$close()
+    expect_equal(m$recv(500L), 15)
+    expect_equal(m$recv(500L), 20)
+
+    m$close(500L)
+})
+
+test_that("lost workers are detected by missing heartbeats", {
+    m = methods::new(CMQMaster)
+    w = methods::new(CMQWorker, m$context())
+    addr = m$listen("inproc://endpoint")
+    m$add_pending_workers(1L)
+    m$set_heartbeat(100L, 2L)
+    w$connect(addr, 500L)
+
+    m$recv(500L)
+    m$send_eval(expression(Sys.sleep(0.5)))
+    expect_true(w$process_one())
+    expect_null(m$recv(1000L))
+    m$send_eval(expression(1))
+    w$close()
+    expect_error(m$recv(1000L))
+    expect_equal(m$list_workers()$status, "lost")
+
+    m$close(0L)
+})
+
+test_that("results of lost workers are dropped", {
+    skip_on_cran()
+    skip_if_not(has_connectivity("127.0.0.1"))
+
+    m = methods::new(CMQMaster)
+    addr = m$listen("tcp://127.0.0.1:*")
+    m$add_pending_workers(2L)
+    m$set_heartbeat(100L, 2L)
+    lg = methods::new(CMQLoadGen) # replies after 600 ms, without heartbeats
+    lg$start(addr, 1L, 1L, 600L, 10L, 0L)
+
+    expect_null(m$recv(2000L))
+    m$send_eval(expression(NULL))
+    expect_error(m$recv(1000L), "no heartbeat")
+    w = methods::new(CMQWorker)
+    w$connect(addr, 500L)
+    expect_null(m$recv(1000L))
+    m$send_eval(expression(1))
+    Sys.sleep(0.5) # late result of the lost worker arrives first
+    expect_true(w$process_one())
+    expect_equal(m$recv(1000L), 1)
+    expect_equal(sort(m$list_workers()$status), c("active", "lost"))
+
+    w$close()
+    lg$stop(0L)
+    m$close(0L)
+})
+
 test_that("export variable to worker", {
     m = methods::new(CMQMaster)
     w = methods::new(CMQWorker, m$context())
@@ -66,6 +154,225 @@ test_that("export variable to worker", {
     m$close(500L)
 })
 
+test_that("identical objects are not sent again", {
+    m = methods::new(CMQMaster)
+    w = methods::new(CMQWorker, m$context())
+    addr = m$listen("inproc://endpoint")
+    m$add_pending_workers(1L)
+    w$connect(addr, 500L)
+
+    m$add_env("x", 3)
+    m$recv(500L)
+    m$send_eval(expression(x <- x + 1)) # modify worker copy
+    w$process_one()
+    expect_equal(m$recv(500L), 4)
+    env = m$stats()$env
+    sent = env$sent[env$object == "x"]
+
+    m$add_env("x", 3) # bound again from the worker cache
+    m$add_env("y", 3)
+    m$send_eval(expression(c(x, y)))
+    w$process_one()
+    expect_equal(m$recv(500L), c(3, 3))
+    env = m$stats()$env
+    expect_equal(env$sent[env$object == "x"], sent)
+
+    w$close()
+    m$close(500L)
+})
+
+test_that("raw vectors and large objects are serialized", {
+    m = methods::new(CMQMaster)
+    w = methods::new(CMQWorker, m$context())
+    addr = m$listen("inproc://endpoint")
+    m$add_pending_workers(1L)
+    w$connect(addr, 500L)
+
+    x = runif(1e6)
+    m$add_env("x", x)
+    m$add_env("r", as.raw(1:10))
+    m$recv(500L)
+    m$send_eval(expression(list(sum(x), r)))
+    status = w$process_one()
+    result = m$recv(500L)
+    expect_true(status)
+    expect_equal(result, list(sum(x), as.raw(1:10)))
+
+    w$close()
+    m$close(500L)
+})
+
+test_that("compressed common data and results", {
+    m = methods::new(CMQMaster)
+    w = methods::new(CMQWorker, m$context())
+    addr = m$listen("inproc://endpoint")
+    m$add_pending_workers(1L)
+    w$connect(addr, 500L)
+
+    m$set_compress(1000L)
+    x = rep(1:10, 1e5)
+    m$add_env("x", x)
+    m$add_env("y", 1)
+    env = m$list_env()
+    expect_true(env$compressed[env$object == "x"] < env$size[env$object == "x"] / 10)
+    expect_equal(env$compressed[env$object == "y"], env$size[env$object == "y"])
+
+    m$recv(500L)
+    m$send_eval(expression(rev(x) + y))
+    status = w$process_one()
+    result = m$recv(500L)
+    expect_true(status)
+    expect_equal(result, rev(x) + 1)
+
+    w$close()
+    m$close(500L)
+})
+
+test_that("modified objects are sent as delta", {
+    m = methods::new(CMQMaster)
+    w = methods::new(CMQWorker, m$context())
+    addr = m$listen("inproc://endpoint")
+    m$add_pending_workers(1L)
+    w$connect(addr, 500L)
+
+    m$set_delta(1000L)
+    x = runif(1e5)
+    m$add_env("x", x)
+    m$recv(500L)
+    m$send_eval(expression(sum(x)))
+    w$process_one()
+    expect_equal(m$recv(500L), sum(x))
+
+    env = m$stats()$env
+    sent = env$sent[env$object == "x"]
+
+    x[c(10, 5e4)] = 0
+    m$add_env("x", x)
+    m$send_eval(expression(sum(x)))
+    status = w$process_one()
+    result = m$recv(500L)
+    expect_true(status)
+    expect_equal(result, sum(x))
+    env = m$stats()$env
+    expect_lt(env$sent[env$object == "x"] - sent, 1e4) # of 800 kb
+
+    w$close()
+    m$close(500L)
+})
+
+test_that("deltas are compressed with the common data", {
+    m = methods::new(CMQMaster)
+    w = methods::new(CMQWorker, m$context())
+    addr = m$listen("inproc://endpoint")
+    m$add_pending_workers(1L)
+    w$connect(addr, 500L)
+
+    m$set_compress(1000L)
+    m$set_delta(1000L)
+    x = runif(1e5)
+    m$add_env("x", x)
+    m$recv(500L)
+    m$send_eval(expression(sum(x)))
+    w$process_one()
+    expect_equal(m$recv(500L), sum(x))
+    env = m$stats()$env
+    sent = env$sent[env$object == "x"]
+
+    x[1:2e4] = 0 # 160 kb of new data in the delta
+    m$add_env("x", x)
+    m$send_eval(expression(sum(x)))
+    expect_true(w$process_one())
+    expect_equal(m$recv(500L), sum(x))
+    env = m$stats()$env
+    expect_lt(env$sent[env$object == "x"] - sent, 1e5)
+
+    w$close()
+    m$close(500L)
+})
+
+test_that("large objects are unserialized on first use", {
+    m = methods::new(CMQMaster)
+    w = methods::new(CMQWorker, m$context())
+    addr = m$listen("inproc://endpoint")
+    m$add_pending_workers(1L)
+    w$connect(addr, 500L)
+
+    m$set_lazy(1000L)
+    x = runif(1e5)
+    m$add_env("x", x)
+    m$add_env("x2", x)
+    m$add_env("y", 1)
+    m$recv(500L)
+    m$send_eval(expression(y))
+    expect_true(w$process_one())
+    expect_equal(m$recv(500L), 1)
+    expect_equal(w$stats()$lazy, 1) # x and x2 share one cached object
+
+    m$send_eval(expression(c(sum(x), sum(x2), y)))
+    expect_true(w$process_one())
+    expect_equal(m$recv(500L), c(sum(x), sum(x), 1))
+    expect_equal(w$stats()$lazy, 0)
+
+    w$close()
+    m$close(500L)
+})
+
+test_that("local workers map common data from shared memory", {
+    skip_on_os("windows")
+    skip_if_not(dir.exists("/dev/shm"))
+
+    m = methods::new(CMQMaster)
+    w = methods::new(CMQWorker, m$context())
+    addr = m$listen_local()
+    m$add_pending_workers(1L)
+    m$set_shm(1000L)
+    x = runif(1e5)
+    m$add_env("x", x)
+    m$add_env("y", 1)
+    w$connect(addr, 500L)
+
+    m$recv(500L)
+    m$send_eval(expression(sum(x) + y))
+    status = w$process_one()
+    result = m$recv(500L)
+    expect_true(status)
+    expect_equal(result, sum(x) + 1)
+    env = m$stats()$env
+    expect_lt(env$sent[env$object == "x"], 1000) # segment name, not 800 kb
+
+    w$close()
+    m$close(500L)
+})
+
+test_that("common data is sent as frames if shared memory fails", {
+    skip_on_os("windows")
+
+    x = runif(1e5)
+    m1 = methods::new(CMQMaster)
+    m1$listen_local()
+    m1$set_shm(1000L)
+    m1$add_env("x", x) # holds the segment name for this object
+
+    m = methods::new(CMQMaster)
+    w = methods::new(CMQWorker, m$context())
+    addr = m$listen_local()
+    m$add_pending_workers(1L)
+    m$set_shm(1000L)
+    m$add_env("x", x) # segment exists, so it can not be created
+    w$connect(addr, 500L)
+
+    m$recv(500L)
+    m$send_eval(expression(sum(x)))
+    expect_true(w$process_one())
+    expect_equal(m$recv(500L), sum(x))
+    env = m$stats()$env
+    expect_gt(env$sent[env$object == "x"], 8e5)
+
+    w$close()
+    m$close(500L)
+    m1$close(0L)
+})
+
 test_that("load package on worker", {
     m = methods::new(CMQMaster)
     w = methods::new(CMQWorker, m$context())
@@ -153,6 +460,59 @@ test_that("worker memory tracks non-R allocations", {
     m$close(500L)
 })
 
+test_that("large objects are fetched in fragments", {
+    skip_on_os("windows")
+    skip_if_not(has_connectivity("127.0.0.1"))
+
+    m = methods::new(CMQMaster)
+    addr = m$listen("tcp://127.0.0.1:*")
+    m$add_pending_workers(1L)
+    m$set_fragment(10000L)
+    x = runif(1e5)
+    m$add_env("x", x)
+    m$add_env("y", 1:10)
+    p = parallel::mcparallel(worker(addr))
+
+    expect_null(m$recv(5000L))
+    m$send_eval(expression(c(sum(x), sum(y))))
+    expect_equal(m$recv(5000L), c(sum(x), 55))
+
+    m$send_shutdown()
+    pc = parallel::mccollect(p, wait=TRUE, timeout=0.5)
+    expect_equal(pc[[1]], NULL)
+    m$close(500L)
+})
+
+test_that("large objects are relayed between workers", {
+    skip_on_os("windows")
+    skip_if_not(has_connectivity("127.0.0.1"))
+
+    m = methods::new(CMQMaster)
+    addr = m$listen("tcp://127.0.0.1:*")
+    m$add_pending_workers(2L)
+    m$set_fragment(10000L)
+    m$set_broadcast(1L, 6000:9999, 5000L)
+    x = runif(1e5)
+    m$add_env("x", x)
+    w1 = parallel::mcparallel(worker(addr))
+    w2 = parallel::mcparallel(worker(addr))
+
+    res = list()
+    for (i in 1:4) {
+        r = m$recv(5000L)
+        if (is.null(r)) {
+            m$send_eval(expression(sum(x)))
+        } else {
+            res = c(res, r)
+            m$send_shutdown()
+        }
+    }
+    expect_equal(unlist(res), rep(sum(x), 2))
+
+    parallel::mccollect(list(w1, w2), wait=TRUE, timeout=0.5)
+    m$close(500L)
+})
+
 test_that("communication with two workers", {
     skip_on_os("windows")
     skip_if_not(has_connectivity("127.0.0.1"))
@@ -180,3 +540,29 @@ test_that("communication with two workers", {
 
     m$close(500L)
 })
+
+test_that("synthetic workers answer calls", {
+    skip_on_cran()
+    skip_if_not(has_connectivity("127.0.0.1"))
+
+    m = methods::new(CMQMaster)
+    addr = m$listen("tcp://127.0.0.1:*")
+    m$add_pending_workers(20L)
+    lg = methods::new(CMQLoadGen)
+    lg$start(addr, 20L, 2L, 1L, 100L, 0L)
+
+    for (i in 1:20) {
+        expect_null(m$recv(5000L))
+        m$send_eval(expression(NULL))
+    }
+    for (i in 1:20) {
+        expect_equal(m$recv(5000L), raw(100))
+        m$send_shutdown()
+    }
+    res = lg$stop(5000L)
+    m$close(500L)
+
+    expect_equal(res$calls, 20)
+    expect_equal(res$open, 0)
+    expect_equal(res$stages$count, c(20, 0))
+})
@@ -28,6 +28,21 @@ test_that("starting and stopping multicore", {
     expect_equal(w$workers_total, 0)
 })
 
+test_that("multicore workers forked after export hold common data", {
+    skip_on_os("windows")
+
+    w = workers(1, qsys_id="multicore", fork_env=TRUE)
+    w$env(x=3)
+    expect_null(w$recv(5000L))
+    w$send_eval(x + 4)
+    expect_equal(w$recv(1000L), 7)
+    w$env(x=5)
+    w$send_eval(x + 4)
+    expect_equal(w$recv(1000L), 9)
+    w$send_shutdown()
+    w$cleanup()
+})
+
 test_that("pending workers area cleaned up properly", {
     skip_on_os("windows")
     w = workers(1, qsys_id="multicore")
@@ -49,6 +64,56 @@ test_that("calculations are really done on the worker", {
     w$cleanup()
 })
 
+test_that("stage timings and bytes are reported with stats enabled", {
+    skip_on_os("windows")
+
+    prom_file = tempfile()
+    old_opt = options(clustermq.stats = prom_file)
+    on.exit(options(old_opt))
+
+    w = workers(1, qsys_id="multicore")
+    expect_null(w$recv(5000L))
+    w$env(y = 3)
+    w$send_eval(y + 4)
+    expect_equal(w$recv(1000L), 7)
+    stats = w$stats()
+    master = setNames(stats$master$stages$count, stats$master$stages$stage)
+    expect_equal(master[["roundtrip"]], 1)
+    worker = setNames(stats$workers$stages$count, stats$workers$stages$stage)
+    expect_equal(worker[["eval"]], 1)
+    expect_true(stats$env$sent[stats$env$object == "y"] > 0)
+    expect_true(all(w$info()$received > 0))
+    w$send_shutdown()
+    w$cleanup()
+
+    prom = readLines(prom_file)
+    expect_true('clustermq_worker_stage_seconds_count{stage="eval"} 1' %in% prom)
+    unlink(prom_file)
+})
+
+test_that("calls are written to a trace file", {
+    skip_on_os("windows")
+
+    trace_file = tempfile()
+    old_opt = options(clustermq.trace = trace_file)
+    on.exit(options(old_opt))
+
+    w = workers(1, qsys_id="multicore")
+    expect_null(w$recv(5000L))
+    w$env(y = 3)
+    r = w$send_eval(y + 4)
+    expect_equal(w$recv(1000L), 7)
+    w$send_shutdown()
+    w$cleanup()
+
+    trace = paste(readLines(trace_file), collapse="\n")
+    expect_true(grepl('"traceEvents"', trace, fixed=TRUE))
+    expect_true(grepl('"name":"eval","cat":"call","ph":"X"', trace, fixed=TRUE))
+    expect_true(grepl(sprintf('"call_ref":%i', r), trace, fixed=TRUE))
+    expect_true(grepl('"name":"y","cat":"env"', trace, fixed=TRUE))
+    unlink(trace_file)
+})
+
 test_that("call references are matched properly", {
     skip_on_os("windows")
     skip_on_cran()
@@ -67,6 +132,66 @@ test_that("call references are matched properly", {
     w$cleanup()
 })
 
+test_that("native map slices chunks and places results", {
+    skip_on_os("windows")
+
+    w = workers(2, qsys_id="multicore", reuse=FALSE)
+    w$env(work_chunk=work_chunk, fun=function(x, f) paste(x, f), const=list(),
+          rettype="character", common_seed=1L)
+    iter = data.frame(x=1:10, f=factor(letters[1:10]))
+    cmd = quote(work_chunk(chunk, fun=fun, const=const, rettype=rettype,
+                           common_seed=common_seed))
+    res = w$map(iter, cmd, rep(NA_character_, 10), chunk_size=3, timeout=5000L)
+    w$cleanup()
+
+    expect_equal(res$result, paste(1:10, letters[1:10]))
+    expect_equal(res$n_errors, 0)
+    expect_equal(res$submitted, 10)
+})
+
+test_that("columnar and serialized chunks keep column types", {
+    skip_on_os("windows")
+
+    w = workers(1, qsys_id="multicore")
+    w$env(work_chunk=work_chunk, const=list(), rettype="character", common_seed=1L,
+          fun=function(d, s, l, o) paste(d, s, l, o, is.ordered(o)))
+    iter = list(d=c(0.5, NA, 2), s=c("a", NA, "\u00e4"), l=c(TRUE, NA, FALSE),
+                o=factor(c("lo", "hi", "lo"), levels=c("lo", "hi"), ordered=TRUE))
+    cmd = quote(work_chunk(chunk, fun=fun, const=const, rettype=rettype,
+                           common_seed=common_seed))
+    res = w$map(iter, cmd, rep(NA_character_, 3), chunk_size=2, timeout=5000L)
+    expect_equal(res$result, do.call(paste, c(unname(iter), TRUE)))
+
+    w$env(fun=function(x) sum(x))
+    iter = list(x=list(1:2, 3, 4:6))
+    res = w$map(iter, cmd, rep(NA_character_, 3), chunk_size=2, timeout=5000L)
+    w$cleanup()
+
+    expect_equal(res$result, c("3", "3", "15"))
+    expect_equal(res$submitted, 3)
+})
+
+test_that("atomic results are placed from typed frames", {
+    skip_on_os("windows")
+
+    w = workers(2, qsys_id="multicore")
+    w$env(work_chunk=work_chunk, const=list(), rettype="numeric", common_seed=1L,
+          fun=function(x) x * 2)
+    cmd = quote(work_chunk(chunk, fun=fun, const=const, rettype=rettype,
+                           common_seed=common_seed))
+    res = w$map(list(x=as.numeric(1:1000)), cmd, rep(NA_real_, 1000),
+                chunk_size=100, timeout=5000L)
+    expect_equal(res$result, as.numeric(1:1000) * 2)
+
+    # integer results coerce a logical result vector
+    w$env(fun=function(x) x + 1L)
+    res = w$map(list(x=1:10), cmd, rep(NA, 10), chunk_size=3, timeout=5000L)
+    w$cleanup()
+
+    expect_equal(res$result, 2:11)
+    expect_equal(res$submitted, 10)
+})
+
 test_that("multiprocess", {
     skip("https://github.com/r-lib/processx/issues/236")
 
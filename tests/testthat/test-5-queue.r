@@ -105,6 +105,51 @@ test_that("shutdown monitor does not fire on clean disconnects", {
     expect_equal(res, list(NULL, NULL))
 })
 
+test_that("chunks are prefetched by workers", {
+    skip_on_os("windows")
+
+    old_opt = getOption("clustermq.prefetch")
+    on.exit(options(clustermq.prefetch = old_opt))
+    options(clustermq.prefetch = 3L)
+
+    fx = function(x) x*2
+    w = workers(n_jobs=2, qsys_id="multicore", reuse=FALSE)
+    r = Q(fx, x=1:20, workers=w, chunk_size=2, timeout=10L)
+    expect_equal(r, as.list(1:20*2))
+})
+
+test_that("chunk sizes adapt to call times", {
+    skip_on_os("windows")
+
+    old_opt = getOption("clustermq.chunk_time")
+    on.exit(options(clustermq.chunk_time = old_opt))
+    options(clustermq.chunk_time = 0.1)
+
+    fx = function(x) { Sys.sleep(x %% 2 * 0.01); x*2 }
+    w = workers(n_jobs=2, qsys_id="multicore", reuse=FALSE)
+    r = Q(fx, x=1:200, workers=w, timeout=10L)
+    expect_equal(r, as.list(1:200*2))
+})
+
+test_that("chunks of lost workers are sent to other workers", {
+    skip_on_cran()
+    skip_on_os("windows")
+
+    old_opt = options(clustermq.heartbeat = 0.2)
+    on.exit(options(old_opt))
+
+    flag = tempfile()
+    fx = function(x, flag) {
+        if (x == 1 && !file.exists(flag) && file.create(flag))
+            tools::pskill(Sys.getpid(), tools::SIGKILL)
+        x * 2
+    }
+    w = workers(n_jobs=2, qsys_id="multicore", reuse=FALSE)
+    expect_warning(r <- Q(fx, x=1:10, const=list(flag=flag), workers=w,
+                          chunk_size=1, timeout=10L), "lost")
+    expect_equal(r, as.list(1:10*2))
+})
+
 test_that("max_calls_worker is respected", {
     skip_on_cran()
     skip_on_os("windows")
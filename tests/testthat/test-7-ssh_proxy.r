@@ -29,6 +29,107 @@ test_that("simple forwarding works", {
     m$close(0L)
 })
 
+test_that("forwarding in a separate thread works", {
+    skip_if_not(has_localhost)
+
+    m = methods::new(CMQMaster)
+    p = methods::new(CMQProxy)
+    w = methods::new(CMQWorker)
+    addr1 = m$listen("tcp://127.0.0.1:*")
+    addr2 = p$listen("tcp://127.0.0.1:*")
+    m$add_pending_workers(1L)
+    p$connect(addr1, 500L)
+    w$connect(addr2, 500L)
+    p$start()
+    expect_error(p$process_one())
+    expect_null(m$recv(500L)) # worker up
+    m$add_env("x", 3)
+    m$send_eval(expression(5 + x))
+    expect_true(w$process_one())
+    expect_equal(m$recv(500L), 8)
+    expect_true(p$wait(0L))
+
+    w$close()
+    p$close(0L)
+    m$close(0L)
+})
+
+test_that("nested proxies forward and fill in common data", {
+    skip_if_not(has_localhost)
+
+    m = methods::new(CMQMaster)
+    p1 = methods::new(CMQProxy)
+    p2 = methods::new(CMQProxy)
+    w = methods::new(CMQWorker)
+    addr1 = m$listen("tcp://127.0.0.1:*")
+    addr2 = p1$listen("tcp://127.0.0.1:*")
+    addr3 = p2$listen("tcp://127.0.0.1:*")
+    m$add_pending_workers(1L)
+    p1$connect(addr1, 500L)
+    p2$connect(addr2, 500L)
+    w$connect(addr3, 500L)
+    expect_true(p2$process_one())
+    expect_true(p1$process_one())
+    expect_null(m$recv(500L)) # worker up
+
+    m$add_env("x", 1:10)
+    m$send_eval(expression(sum(x)))
+    expect_true(p1$process_one())
+    expect_true(p2$process_one())
+    expect_true(w$process_one())
+    expect_true(p2$process_one())
+    expect_true(p1$process_one())
+    expect_equal(m$recv(500L), 55)
+    expect_equal(m$list_workers()$status, "active")
+
+    w$close()
+    p2$close(0L)
+    p1$close(0L)
+    m$close(0L)
+})
+
+test_that("proxy cache drops least recently used objects", {
+    skip_if_not(has_localhost)
+
+    m = methods::new(CMQMaster)
+    p = methods::new(CMQProxy)
+    w1 = methods::new(CMQWorker)
+    w2 = methods::new(CMQWorker)
+    addr1 = m$listen("tcp://127.0.0.1:*")
+    addr2 = p$listen("tcp://127.0.0.1:*")
+    m$add_pending_workers(2L)
+    m$set_proxy_cache(1.2e6) # fits one of the objects below
+    p$connect(addr1, 500L)
+    p$start()
+    w1$connect(addr2, 500L)
+    expect_null(m$recv(500L)) # worker 1 up
+
+    m$add_env("a", runif(1e5))
+    m$send_eval(expression(length(a)))
+    expect_true(w1$process_one())
+    expect_equal(m$recv(500L), 1e5)
+    m$add_env("b", runif(1e5))
+    m$send_eval(expression(length(b))) # proxy drops 'a'
+    expect_true(w1$process_one())
+    expect_equal(m$recv(500L), 1e5)
+
+    w2$connect(addr2, 500L)
+    expect_null(m$recv(500L)) # worker 2 up
+    m$send_eval(expression(length(a) + length(b)))
+    expect_true(w2$process_one())
+    expect_equal(m$recv(500L), 2e5)
+
+    env = m$stats()$env
+    sent = stats::setNames(env$sent, env$object)
+    expect_gt(sent[["a"]], 1.5e6) # sent again
+    expect_lt(sent[["b"]], 1.2e6) # forwarded from the proxy cache
+
+    w1$close()
+    w2$close()
+    p$close(0L)
+    m$close(0L)
+})
+
 test_that("proxy communication yields submit args", {
     skip_if_not(has_localhost)
     skip_on_cran()